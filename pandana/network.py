@@ -4,7 +4,7 @@ import numpy as np
 import pandas as pd
 from sklearn.neighbors import KDTree
 
-from .cyaccess import cyaccess
+from .cyaccess import cyaccess, read_skim
 from .loaders import pandash5 as ph5
 import warnings
 
@@ -62,10 +62,26 @@ class Network:
         network. If twoway = False, it is assumed that travel can only occur
         in the explicit direction indicated by the from and to ID in the edge
         table.
+    hierarchy : str, optional (default 'ch')
+        How the network is preprocessed for queries: 'ch' builds a
+        contraction hierarchy for each impedance, while 'cch' orders and
+        contracts the network once, without looking at the impedances, and
+        then only customizes that hierarchy with the weights of each
+        impedance.  'cch' is much faster to build, especially when there
+        are several impedances, while shortest path queries on it take a
+        few times longer.
+    ch_file : str, optional
+        A file written by save_ch for a network with the same nodes, edges
+        and impedances.  Its contraction hierarchies are used in place of
+        building them, which is most of the time taken to create a large
+        network - see load_ch.
 
     """
 
-    def __init__(self, node_x, node_y, edge_from, edge_to, edge_weights, twoway=True):
+    def __init__(
+        self, node_x, node_y, edge_from, edge_to, edge_weights, twoway=True,
+        hierarchy="ch", ch_file=None
+    ):
         nodes_df = pd.DataFrame({"x": node_x, "y": node_y})
         edges_df = pd.DataFrame({"from": edge_from, "to": edge_to}).join(edge_weights)
 
@@ -76,6 +92,7 @@ class Network:
         self.variable_names = set()
         self.poi_category_names = []
         self.poi_category_indexes = {}
+        self.target_set_indexes = {}
 
         # this maps IDs to indexes which are used internally
         # this is a constant source of headaches, but all node identifiers
@@ -86,17 +103,23 @@ class Network:
             np.arange(len(nodes_df), dtype="int"), index=nodes_df.index
         )
 
-        edges = pd.concat(
-            [self._node_indexes(edges_df["from"]), self._node_indexes(edges_df["to"])],
-            axis=1,
+        # the arrays are built contiguous so that the extension can read
+        # them in place
+        edges = np.column_stack(
+            [self._node_indexes(edges_df["from"]), self._node_indexes(edges_df["to"])]
+        ).astype("int", copy=False)
+        weights = np.ascontiguousarray(
+            edges_df[edge_weights.columns].to_numpy(dtype="double").T
         )
 
         self.net = cyaccess(
             self.node_idx.values,
             nodes_df.astype("double").values,
-            edges.values,
-            edges_df[edge_weights.columns].transpose().astype("double").values,
+            edges,
+            weights,
             twoway,
+            hierarchy.encode("utf-8"),
+            ch_file.encode("utf-8") if ch_file is not None else b"",
         )
 
         self._twoway = twoway
@@ -119,6 +142,110 @@ class Network:
         """
         return ph5.network_from_pandas_hdf5(cls, filename)
 
+    @classmethod
+    def load_ch(
+        cls, node_x, node_y, edge_from, edge_to, edge_weights, filename,
+        twoway=True
+    ):
+        """
+        Create a Network whose contraction hierarchies are loaded from a
+        file written by save_ch, instead of being built.  The file is
+        memory mapped, so processes loading the same file share one copy of
+        it.  The nodes, edges and impedances must be the same as those of
+        the network it was saved from, which is checked.
+
+        Parameters
+        ----------
+        node_x, node_y, edge_from, edge_to, edge_weights, twoway
+            As for the constructor.
+        filename : str
+            A file written by save_ch.
+
+        Returns
+        -------
+        network : pandana.Network
+
+        """
+        return cls(
+            node_x, node_y, edge_from, edge_to, edge_weights, twoway=twoway,
+            ch_file=filename
+        )
+
+    def save_ch(self, filename):
+        """
+        Saves the contraction hierarchies of this network to a file, so
+        that later sessions can skip building them with load_ch.
+
+        Parameters
+        ----------
+        filename : str
+            The file to write.
+
+        Returns
+        -------
+        Nothing
+        """
+        self.net.save_ch(filename.encode("utf-8"))
+
+    def update_weights(self, weights, imp_name=None):
+        """
+        Changes the weights of some of the edges for one impedance, e.g. to
+        close a road or apply congested travel times.  Rather than building
+        the contraction hierarchy again, it is customized for the new
+        weights (see the hierarchy argument of the constructor), which after
+        the first update only redoes the part of it above the changed edges.
+        POIs and target sets stay in place, while the range queries of
+        precompute are dropped and have to be computed again.  What
+        save_ch and save_precomputed write afterwards can be loaded into a
+        network built with the new weights.
+
+        Parameters
+        ----------
+        weights : pandas.Series
+            The new weights, indexed like the edge_weights passed to the
+            constructor - edges not in it keep their weights.
+        imp_name : string, optional
+            The impedance to change, which may be left out if there is only
+            one.
+
+        Returns
+        -------
+        Nothing
+        """
+        imp_num = self._imp_name_to_num(imp_name)
+        positions = self.edges_df.index.get_indexer(weights.index)
+        if (positions < 0).any():
+            raise ValueError("weights are indexed by edges not in the network")
+
+        self.net.update_edge_weights(
+            positions.astype("int"), weights.values.astype("double"), imp_num
+        )
+        self.edges_df.iloc[
+            positions, self.edges_df.columns.get_loc(self.impedance_names[imp_num])
+        ] = weights.values
+
+    def memory_usage(self):
+        """
+        The memory taken by the routing data of the network. The edges are
+        stored once for all the impedances, which only keep their own
+        weights and contraction hierarchies.
+
+        Returns
+        -------
+        usage : pandas.DataFrame
+            The bytes taken by each part (the index), with a column "shared"
+            for the parts shared by the impedances and a column for each
+            impedance. Parts an impedance doesn't have are 0.
+        """
+        usage = {"shared": self.net.memory_usage(-1)}
+        for imp_num, imp_name in enumerate(self.impedance_names):
+            usage[imp_name] = self.net.memory_usage(imp_num)
+        usage = {
+            col: {part.decode(): size for part, size in parts.items()}
+            for col, parts in usage.items()
+        }
+        return pd.DataFrame(usage, columns=list(usage)).fillna(0).astype("int64")
+
     def save_hdf5(self, filename, rm_nodes=None):
         """
         Save network data to a Pandas HDF5 file.
@@ -243,10 +370,13 @@ class Network:
 
         imp_num = self._imp_name_to_num(imp_name)
 
-        paths = self.net.shortest_paths(nodes_a_idx, nodes_b_idx, imp_num)
+        offsets, path_nodes = self.net.shortest_paths(
+            nodes_a_idx, nodes_b_idx, imp_num
+        )
 
         # map back to external node ids
-        return [self.node_ids.values[p] for p in paths]
+        ids = self.node_ids.values[path_nodes]
+        return [ids[offsets[i]:offsets[i + 1]] for i in range(len(offsets) - 1)]
 
     def shortest_path_length(self, node_a, node_b, imp_name=None):
         """
@@ -328,16 +458,181 @@ class Network:
 
         lens = self.net.shortest_path_distances(nodes_a_idx, nodes_b_idx, imp_num)
 
-        if 4294967.295 in lens:
-            unconnected_idx = [i for i, v in enumerate(lens) if v == 4294967.295]
+        unconnected_idx = np.flatnonzero(lens == 4294967.295)
+        if len(unconnected_idx) > 0:
             unconnected_nodes = [(nodes_a[i], nodes_b[i]) for i in unconnected_idx]
             warnings.warn(
                 "Unsigned integer: shortest path distance is trying to be calculated \
                 between the following external unconnected nodes: %s" % (unconnected_nodes))
 
-        return lens
+        return lens.tolist()
+
+    def shortest_path_length_matrix(self, nodes_a, nodes_b, imp_name=None):
+        """
+        Shortest path lengths between every origin and every destination,
+        e.g. to build a skim.  This is much faster than calling
+        shortest_path_lengths with all the pairs, as it only needs one
+        search per origin and one per destination.  Must provide an
+        impedance name if more than one is available.
+
+        Parameters
+        ----------
+        nodes_a : list-like of ints
+            Source node IDs
+        nodes_b : list-like of ints
+            Destination node IDs
+        imp_name : string
+            The impedance name to use for the shortest paths
+
+        Returns
+        -------
+        lengths : numpy.ndarray of float32
+            A row for each origin and a column for each destination.
+            Unreachable destinations have the same length as in
+            shortest_path_lengths, in float32.
+
+        """
+        nodes_a_idx = self._node_indexes(pd.Series(nodes_a)).values
+        nodes_b_idx = self._node_indexes(pd.Series(nodes_b)).values
+
+        imp_num = self._imp_name_to_num(imp_name)
+
+        return self.net.shortest_path_distance_matrix(
+            nodes_a_idx, nodes_b_idx, imp_num)
+
+    def write_skim(self, filename, nodes_a, nodes_b, imp_name=None,
+                   tile_size=1024, memory_mb=1024):
+        """
+        Write the shortest path lengths between every origin and every
+        destination to a skim file, for matrices too large to hold in
+        memory.  The matrix is computed in tiles, in parallel, and each is
+        compressed and written as soon as it is done, so if the run is
+        interrupted calling this again with the same arguments only
+        computes the missing tiles.  Read it back with read_skim.
+
+        Parameters
+        ----------
+        filename : string
+            The skim file to write
+        nodes_a : list-like of ints
+            Source node IDs
+        nodes_b : list-like of ints
+            Destination node IDs
+        imp_name : string
+            The impedance name to use for the shortest paths
+        tile_size : int, optional
+            The number of origins and destinations in a tile
+        memory_mb : float, optional
+            Roughly the most memory to use for the tiles, in megabytes
+
+        Returns
+        -------
+        Nothing
+
+        """
+        nodes_a_idx = self._node_indexes(pd.Series(nodes_a)).values
+        nodes_b_idx = self._node_indexes(pd.Series(nodes_b)).values
+
+        imp_num = self._imp_name_to_num(imp_name)
+
+        self.net.write_skim(filename.encode("utf-8"), nodes_a_idx,
+                            nodes_b_idx, imp_num, tile_size, memory_mb)
+
+    def read_skim(self, filename, first_row=0, num_rows=None):
+        """
+        Read rows of a skim written by write_skim on this network.
+
+        Parameters
+        ----------
+        filename : string
+            The skim file to read
+        first_row : int, optional
+            The first origin to read
+        num_rows : int, optional
+            The number of origins to read, all the rest by default
+
+        Returns
+        -------
+        lengths : pandas.DataFrame of float32
+            A row for each origin read and a column for each destination,
+            labeled by their node IDs
+
+        """
+        lens, sources, targets = read_skim(
+            filename.encode("utf-8"), first_row,
+            -1 if num_rows is None else num_rows)
+        node_ids = self.node_idx.index.values
+        return pd.DataFrame(lens, index=node_ids[sources],
+                            columns=node_ids[targets])
+
+    def set_targets(self, node_ids, name="tmp"):
+        """
+        Set the destinations of a one-to-many distance query, so that the
+        distances to all of them can then be found quickly from any number
+        of origins with shortest_path_lengths_to_targets.  The part of the
+        contraction hierarchy which leads down to the targets is extracted
+        once here, and each origin then only needs a search up the
+        hierarchy and a sweep over that part (RPHAST).
+
+        Parameters
+        ----------
+        node_ids : pandas.Series, int
+            A series of node_ids which are usually computed using
+            get_node_ids on this object.  The index of the series labels
+            the targets in the results.
+        name : string, optional
+            Name the target set.
+
+        Returns
+        -------
+        Nothing
+
+        """
+        if not isinstance(node_ids, pd.Series):
+            node_ids = pd.Series(node_ids)
+
+        node_idx = self._node_indexes(node_ids)
+        self.target_set_indexes[name] = node_ids.index
+        self.net.initialize_target_set(name.encode("utf-8"), node_idx.values)
 
-    def set(self, node_ids, variable=None, name="tmp"):
+    def shortest_path_lengths_to_targets(self, nodes, name="tmp", imp_name=None):
+        """
+        Shortest path lengths from each of a list of origins to all the
+        targets of a target set.  Must provide an impedance name if more
+        than one is available.
+
+        Parameters
+        ----------
+        nodes : list-like of ints
+            Source node IDs
+        name : string, optional
+            The name of a target set given to set_targets
+        imp_name : string
+            The impedance name to use for the shortest paths
+
+        Returns
+        -------
+        lengths : pandas.DataFrame
+            A row for each origin and a column for each target, labeled by
+            the index of the node_ids given to set_targets.  Unreachable
+            targets have the same length as in shortest_path_lengths.
+
+        """
+        if name not in self.target_set_indexes:
+            raise ValueError("Target set {} has not been set".format(name))
+
+        nodes_idx = self._node_indexes(pd.Series(nodes)).values
+        imp_num = self._imp_name_to_num(imp_name)
+
+        lens = self.net.shortest_path_distances_to_targets(
+            nodes_idx, name.encode("utf-8"), imp_num)
+
+        targets = self.target_set_indexes[name]
+        return pd.DataFrame(np.reshape(lens, (len(nodes_idx), len(targets))),
+                            index=nodes,
+                            columns=targets)
+
+    def set(self, node_ids, variable=None, name="tmp", quantile_bins=None):
         """
         Characterize urban space with a variable that is related to nodes in
         the network.
@@ -367,6 +662,13 @@ class Network:
             default name is used by aggregate on this object, you can
             alternate between characterize and aggregate calls without
             setting names.
+        quantile_bins : int, optional
+            If given, the 25pct, median and 75pct aggregations of this
+            variable are approximated from histograms of the values at each
+            node, with this many bins of equal width between the smallest
+            and largest value.  This is much faster for dense variables at
+            large distances, and the result is within half a bin width of
+            the exact quantile.
 
         Returns
         -------
@@ -391,9 +693,10 @@ class Network:
             name.encode("utf-8"),
             df.node_idx.values.astype("int"),
             df[name].values.astype("double"),
+            quantile_bins or 0,
         )
 
-    def precompute(self, distance):
+    def precompute(self, distance, engine="dijkstra"):
         """
         Precomputes the range queries (the reachable nodes within this
         maximum distance.  So as long as you use a smaller distance, cached
@@ -405,14 +708,55 @@ class Network:
             The maximum distance to use. This will usually be a distance unit
             in meters however if you have customized the impedance this could
             be in other units such as utility or time etc.
+        engine : string, optional (default 'dijkstra')
+            How the nodes within the distance of each node are found:
+            'dijkstra' searches the network around each source, while
+            'phast' sweeps the whole contracted network for a few sources
+            at a time, which is much faster when the distance covers a
+            large part of the network.
+
+        Returns
+        -------
+        Nothing
+        """
+        self.net.precompute_range(distance, self._resolve_engine(engine))
+
+    def save_precomputed(self, filename):
+        """
+        Saves the range queries computed by precompute to a file, so that
+        later sessions on the same network can load them instead of
+        computing them again.
+
+        Parameters
+        ----------
+        filename : str
+            The file to write.
 
         Returns
         -------
         Nothing
         """
-        self.net.precompute_range(distance)
+        self.net.save_precomputed_range(filename.encode("utf-8"))
 
-    def nodes_in_range(self, nodes, radius, imp_name=None):
+    def load_precomputed(self, filename):
+        """
+        Loads range queries saved by save_precomputed, in place of calling
+        precompute.  The file is memory mapped, so processes loading the
+        same file share one copy of it.  The file must have been saved from
+        a network with the same nodes, edges and impedances.
+
+        Parameters
+        ----------
+        filename : str
+            A file written by save_precomputed.
+
+        Returns
+        -------
+        Nothing
+        """
+        self.net.load_precomputed_range(filename.encode("utf-8"))
+
+    def nodes_in_range(self, nodes, radius, imp_name=None, engine="dijkstra"):
         """
         Computes the range queries (the reachable nodes within this maximum
         distance) for each input node.
@@ -431,6 +775,12 @@ class Network:
             Must be one of the impedance names passed in the constructor of
             this object.  If not specified, there must be only one impedance
             passed in the constructor, which will be used.
+        engine : string, optional (default 'dijkstra')
+            How the nodes within the distance of each source are found:
+            'dijkstra' searches the network around each source, while
+            'phast' sweeps the whole contracted network for a few sources
+            at a time, which is much faster when the distance covers a
+            large part of the network.
 
         Returns
         -------
@@ -444,13 +794,16 @@ class Network:
         imp_name = self.impedance_names[imp_num]
         ext_ids = self.node_idx.index.values
 
-        raw_result = self.net.nodes_in_range(nodes, radius, imp_num, ext_ids)
-        clean_result = pd.concat(
-            [
-                pd.DataFrame(r, columns=["destination", imp_name]).assign(source=ix)
-                for r, ix in zip(raw_result, nodes)
-            ]
-        )[["source", "destination", imp_name]]
+        offsets, destinations, distances = self.net.nodes_in_range(
+            nodes, radius, imp_num, ext_ids, self._resolve_engine(engine)
+        )
+        clean_result = pd.DataFrame(
+            {
+                "source": np.repeat(np.asarray(nodes), np.diff(offsets)),
+                "destination": destinations,
+                imp_name: distances,
+            }
+        )
         return (
             clean_result.drop_duplicates(subset=["source", "destination"])
             .reset_index(drop=True)
@@ -470,8 +823,22 @@ class Network:
 
         return self.impedance_names.index(imp_name)
 
+    def _resolve_engine(self, engine):
+        engine = engine.encode("utf-8")
+        assert engine in self.net.get_available_engines(), (
+            "A range query engine with that name was not found"
+        )
+        return engine
+
     def aggregate(
-        self, distance, type="sum", decay="linear", imp_name=None, name="tmp"
+        self,
+        distance,
+        type="sum",
+        decay="linear",
+        imp_name=None,
+        name="tmp",
+        node_ids=None,
+        engine="dijkstra",
     ):
         """
         Aggregate information for every source node in the network - this is
@@ -482,12 +849,14 @@ class Network:
 
         Parameters
         ----------
-        distance : float
+        distance : float or list-like of floats
             The maximum distance to aggregate data within. 'distance' can
             represent any impedance unit that you have set as your edge
             weight. This will usually be a distance unit in meters however
             if you have customized the impedance this could be in other
-            units such as utility or time etc.
+            units such as utility or time etc.  If several distances are
+            passed, the search at the largest one is shared by all of them,
+            which is much faster than aggregating at each distance in turn.
         type : string, optional (default 'sum')
             The type of aggregation: 'mean' (with 'ave', 'avg', 'average'
             as aliases), 'std' (or 'stddev'), 'sum', 'count', 'min', 'max',
@@ -517,43 +886,152 @@ class Network:
             and named by a call to ``set``.  If not specified, the default
             variable name will be used so that the most recent call to set
             without giving a name will be the variable used.
+        node_ids : list-like, optional
+            The network node ids to compute the aggregation for.  If not
+            specified it is computed for every node in the network, which
+            is wasted work when only a few of them are needed.
+        engine : string, optional (default 'dijkstra')
+            How the nodes within the distance of each source are found:
+            'dijkstra' searches the network around each source, while
+            'phast' sweeps the whole contracted network for a few sources
+            at a time, which is much faster when the distance covers a
+            large part of the network.
 
         Returns
         -------
-        agg : pandas.Series
+        agg : pandas.Series or pandas.DataFrame
             Returns a Pandas Series for every origin node in the network,
             with the index which is the same as the node_ids passed to the
             init method and the values are the aggregations for each source
-            node in the network.
+            node in the network.  If node_ids were passed, the index is
+            node_ids instead.  If several distances were passed, returns
+            a Pandas DataFrame with a column per distance instead.
         """
 
         imp_num = self._imp_name_to_num(imp_name)
-        type = type.lower()
-
-        # Resolve aliases
-        if type in ["ave", "avg", "average"]:
-            type = "mean"
-
-        if type in ["stddev"]:
-            type = "std"
-
-        if type in ["med"]:
-            type = "median"
+        type = self._resolve_aggregation_type(type)
+        engine = self._resolve_engine(engine)
 
         assert name in self.variable_names, (
             "A variable with that name " "has not yet been initialized"
         )
 
+        if node_ids is not None:
+            node_ids = pd.Index(node_ids)
+            node_idx = self._node_indexes(node_ids)
+            assert not node_idx.isnull().any(), "node_ids not in the network"
+            node_idx = node_idx.values.astype("int")
+
+            res = self.net.get_aggregate_accessibility_variables(
+                node_idx,
+                distance,
+                name.encode("utf-8"),
+                type.encode("utf-8"),
+                decay.encode("utf-8"),
+                imp_num,
+                engine,
+            )
+
+            if np.ndim(distance) > 0:
+                return pd.DataFrame(
+                    res.transpose(), index=node_ids, columns=list(distance)
+                )
+
+            return pd.Series(res, index=node_ids)
+
         res = self.net.get_all_aggregate_accessibility_variables(
             distance,
             name.encode("utf-8"),
             type.encode("utf-8"),
             decay.encode("utf-8"),
             imp_num,
+            engine,
         )
 
+        if np.ndim(distance) > 0:
+            return pd.DataFrame(
+                res.transpose(), index=self.node_ids, columns=list(distance)
+            )
+
         return pd.Series(res, index=self.node_ids)
 
+    def aggregate_many(
+        self, distance, aggregations, imp_name=None, engine="dijkstra"
+    ):
+        """
+        Compute several aggregations at once for every source node in the
+        network.  This gives the same results as calling ``aggregate`` once
+        per aggregation, but the nodes within the distance of each source
+        node are only searched for once and then shared by all the
+        aggregations, which is much faster when there are many of them.
+
+        Parameters
+        ----------
+        distance : float
+            The maximum distance to aggregate data within, as in
+            ``aggregate``.
+        aggregations : list of tuples
+            One (name, type, decay) tuple per aggregation, where name is a
+            variable created by a call to ``set`` and type and decay are
+            the same as the parameters of ``aggregate``.
+        imp_name : string, optional
+            The impedance name to use for the aggregation on this network.
+            Must be one of the impedance names passed in the constructor of
+            this object.  If not specified, there must be only one impedance
+            passed in the constructor, which will be used.
+        engine : string, optional (default 'dijkstra')
+            How the nodes within the distance of each source are found:
+            'dijkstra' searches the network around each source, while
+            'phast' sweeps the whole contracted network for a few sources
+            at a time, which is much faster when the distance covers a
+            large part of the network.
+
+        Returns
+        -------
+        agg : pandas.DataFrame
+            Returns a Pandas DataFrame with a row for every origin node in
+            the network and a column for every aggregation, which is indexed
+            by the (name, type, decay) tuple passed in.
+        """
+        imp_num = self._imp_name_to_num(imp_name)
+
+        names, types, decays = [], [], []
+        for name, type, decay in aggregations:
+            assert name in self.variable_names, (
+                "A variable with that name " "has not yet been initialized"
+            )
+            names.append(name.encode("utf-8"))
+            types.append(self._resolve_aggregation_type(type).encode("utf-8"))
+            decays.append(decay.encode("utf-8"))
+
+        res = self.net.get_many_aggregate_accessibility_variables(
+            distance, names, types, decays, imp_num, self._resolve_engine(engine)
+        )
+
+        return pd.DataFrame(
+            res.transpose(),
+            index=self.node_ids,
+            columns=pd.MultiIndex.from_tuples(
+                [tuple(a) for a in aggregations], names=["name", "type", "decay"]
+            ),
+        )
+
+    @staticmethod
+    def _resolve_aggregation_type(type):
+        type = type.lower()
+
+        # Resolve aliases
+        if type in ["ave", "avg", "average"]:
+            type = "mean"
+
+        if type in ["stddev"]:
+            type = "std"
+
+        if type in ["med"]:
+            type = "median"
+
+        return type
+
     def get_node_ids(self, x_col, y_col, mapping_distance=None):
         """
         Assign node_ids to data specified by x_col and y_col.
@@ -81,6 +81,11 @@ cyaccess = Extension(
     sources=[
         'src/accessibility.cpp',
         'src/graphalg.cpp',
+        'src/rangecache.cpp',
+        'src/accessibilityvars.cpp',
+        'src/mappedfile.cpp',
+        'src/skim.cpp',
+        'src/chfile.cpp',
         'src/cyaccess.pyx',
         'src/contraction_hierarchies/src/libch.cpp'],
     language='c++',
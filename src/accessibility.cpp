@@ -1,10 +1,15 @@
 #include "accessibility.h"
 #include <algorithm>
 #include <cmath>
-#include <functional>
+#include <exception>
+#include <limits>
+#include <stdexcept>
 #include <unordered_map>
 #include <utility>
 #include "graphalg.h"
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 namespace MTC {
 namespace accessibility {
@@ -14,6 +19,44 @@ using std::vector;
 using std::pair;
 using std::make_pair;
 
+// the largest share of the nodes having a variable for which aggregations
+// push from the nodes with the variable rather than pull from every source
+#define SCATTER_OCCUPANCY 0.1
+
+// a generous estimate of the memory it takes to build the contraction
+// hierarchies of one graph, per edge - road networks need less than this
+#define BUILD_BYTES_PER_EDGE 1024
+
+// the most memory the stats of the threads of an aggregation pushing from
+// the nodes with the variable can take, as each has stats for every node
+#define SCATTER_BYTES (size_t(1) << 30)
+
+
+// how many of numgraphs graphs to build at once - the contraction of a
+// single graph doesn't keep many threads busy, so the graphs are built
+// side by side, as many as there are threads and as fit in the free memory
+static int concurrentBuilds(size_t numedges, int numgraphs) {
+    int builds = std::min(numgraphs, omp_get_max_threads());
+#ifdef _SC_AVPHYS_PAGES
+    double avail = static_cast<double>(sysconf(_SC_AVPHYS_PAGES)) *
+        sysconf(_SC_PAGESIZE);
+    double need = static_cast<double>(numedges) * BUILD_BYTES_PER_EDGE;
+    if (avail > 0 && need > 0) {
+        builds = std::min<double>(builds, avail / need);
+    }
+#endif
+    return std::max(builds, 1);
+}
+
+
+// how many threads can push the items of a variable at once, each into
+// stats for all of numnodes nodes
+static int scatterThreads(int numnodes) {
+    size_t each = std::max<size_t>(1, numnodes * sizeof(NodeStats));
+    return std::max<size_t>(1, std::min<size_t>(omp_get_max_threads(),
+                                                SCATTER_BYTES / each));
+}
+
 typedef std::pair<double, int> distance_node_pair;
 bool distance_node_pair_comparator(const distance_node_pair& l,
                                    const distance_node_pair& r)
@@ -22,9 +65,13 @@ bool distance_node_pair_comparator(const distance_node_pair& l,
 
 Accessibility::Accessibility(
         int numnodes,
-        vector< vector<long>> edges,
-        vector< vector<double>>  edgeweights,
-        bool twoway) {
+        const long *edgeNodes,
+        int numedges,
+        const double *edgeweights,
+        int numgraphs,
+        bool twoway,
+        string hierarchy,
+        string chFile) {
 
     this->aggregations.reserve(9);
     this->aggregations.push_back("sum");
@@ -42,49 +89,236 @@ Accessibility::Accessibility(
     this->decays.push_back("linear");
     this->decays.push_back("flat");
 
-    for (int i = 0 ; i < edgeweights.size() ; i++) {
-        this->addGraphalg(new Graphalg(numnodes, edges, edgeweights[i],
-                          twoway));
+    this->engines.reserve(2);
+    this->engines.push_back("dijkstra");
+    this->engines.push_back("phast");
+
+    if (hierarchy != "ch" && hierarchy != "cch") {
+        throw std::runtime_error("unknown hierarchy " + hierarchy);
+    }
+
+    EdgeArray edges(edgeNodes, numedges);
+    for (int i = 0 ; i < numedges ; i++) {
+        if (edges.from(i) < 0 || edges.from(i) >= numnodes ||
+            edges.to(i) < 0 || edges.to(i) >= numnodes) {
+            throw std::runtime_error("edge node out of range");
+        }
+    }
+
+    if (!chFile.empty()) {
+        vector<uint64_t> fingerprints(numgraphs);
+        for (int i = 0 ; i < numgraphs ; i++) {
+            fingerprints[i] = Graphalg::computeFingerprint(
+                numnodes, edges, edgeweights + size_t(i) * numedges, twoway);
+        }
+        chfile.reset(new CHFile(chFile, fingerprints, numnodes));
+    }
+
+    // the graphs only differ in their weights, so the edges are stored once
+    topology = Graphalg::buildEdgeTopology(numnodes, edges, twoway);
+
+    // a customizable hierarchy is ordered and contracted once for all the
+    // impedances, which then only have to customize it
+    if (hierarchy == "cch" && !chfile) {
+        cch = Graphalg::buildCCHTopology(numnodes, edges);
+    }
+
+    // the graphs are built concurrently, sharing out the threads between
+    // them - the queries on each can still use all of them, as the graphs
+    // make the scratch space of their queries as it's needed
+    int threads = omp_get_max_threads();
+    int builds = concurrentBuilds(numedges, numgraphs);
+    vector<Graphalg *> graphs(numgraphs, NULL);
+    std::exception_ptr error;
+    // the builds and the contraction inside each are two levels of
+    // parallel regions - before OpenMP 3.0 only the builds are parallel
+#if _OPENMP >= 200805
+    int levels = omp_get_max_active_levels();
+    omp_set_max_active_levels(std::max(levels, 2));
+#endif
+    #pragma omp parallel for schedule(dynamic) num_threads(builds)
+    for (int i = 0 ; i < numgraphs ; i++) {
+        omp_set_num_threads(std::max(1, threads / builds));
+        const double *weights = edgeweights + size_t(i) * numedges;
+        try {
+            if (chfile) {
+                graphs[i] = new Graphalg(numnodes, edges, weights,
+                                         twoway, topology, cch,
+                                         chfile->graph(i),
+                                         chfile->graphSize(i));
+            } else {
+                graphs[i] = new Graphalg(numnodes, edges, weights,
+                                         twoway, topology, cch);
+            }
+        } catch (...) {
+            #pragma omp critical
+            error = std::current_exception();
+        }
+    }
+#if _OPENMP >= 200805
+    omp_set_max_active_levels(levels);
+#endif
+
+    for (int i = 0 ; i < graphs.size() ; i++) {
+        if (graphs[i]) this->addGraphalg(graphs[i]);
     }
+    if (error) std::rethrow_exception(error);
 
     this->numnodes = numnodes;
     this->dmsradius = -1;
 }
 
 
+void Accessibility::updateEdgeWeights(vector<long> edge_ids,
+                                      vector<double> weights, int graphno) {
+    if (graphno < 0 || graphno >= ga.size()) {
+        throw std::runtime_error("graph out of range");
+    }
+    if (edge_ids.size() != weights.size()) {
+        throw std::runtime_error("edge ids and weights differ in length");
+    }
+    if (!cch) {
+        cch = ga[graphno]->ch.CreateCCHTopology();
+    }
+    ga[graphno]->updateEdgeWeights(edge_ids, weights, cch);
+
+    dms.clear();
+    dmsradius = -1;
+}
+
+
+std::map<std::string, size_t> Accessibility::memoryUsage(int graphno) {
+    if (graphno == -1) {
+        std::map<std::string, size_t> usage;
+        usage["edge topology"] = topology ? topology->MemoryUsage() : 0;
+        usage["cch topology"] = cch ? cch->MemoryUsage() : 0;
+        return usage;
+    }
+    if (graphno < 0 || graphno >= ga.size()) {
+        throw std::runtime_error("graph out of range");
+    }
+    return ga[graphno]->memoryUsage();
+}
+
+
 void Accessibility::addGraphalg(MTC::accessibility::Graphalg *g) {
     std::shared_ptr<MTC::accessibility::Graphalg>ptr(g);
     this->ga.push_back(ptr);
 }
 
 
+bool
+Accessibility::findRangeEngine(string engine, RangeEngine &e) {
+    int i = std::find(engines.begin(), engines.end(), engine) -
+        engines.begin();
+    e = static_cast<RangeEngine>(i);
+    return i < engines.size();
+}
+
+
+template <class Visit>
 void
-Accessibility::precomputeRangeQueries(float radius) {
-    dms.resize(ga.size());
-    for (int i = 0 ; i < ga.size() ; i++) {
-        dms[i].resize(numnodes);
+Accessibility::forEachRange(int n, const long *srcnodes, float radius,
+                            int graphno, RangeEngine engine, Visit visit) {
+    bool precomputed = dmsradius > 0 && radius <= dmsradius;
+
+    if (engine == RANGE_PHAST && !precomputed) {
+        // each sweep serves a batch of sources
+        int numbatches = (n + PHAST_BATCH - 1) / PHAST_BATCH;
+
+        #pragma omp parallel
+        {
+        vector<vector<NodeID> > nodes;
+        vector<vector<float> > distances;
+        vector<NodeID> batch;
+        QuantileScratch scratch;
+        #pragma omp for schedule(guided)
+        for (int b = 0 ; b < numbatches ; b++) {
+            int first = b * PHAST_BATCH;
+            int last = std::min(n, first + PHAST_BATCH);
+            batch.clear();
+            for (int i = first ; i < last ; i++) {
+                batch.push_back(srcnodes ? srcnodes[i] : i);
+            }
+            ga[graphno]->RangePHAST(batch, radius, nodes, distances);
+            for (int i = first ; i < last ; i++) {
+                RangeResult range = {nodes[i - first].data(),
+                                     distances[i - first].data(),
+                                     static_cast<int>(
+                                         nodes[i - first].size())};
+                visit(i, range, scratch);
+            }
+        }
+        }
+        return;
     }
 
     #pragma omp parallel
     {
+    RangeBuffer tmp;
+    QuantileScratch scratch;
     #pragma omp for schedule(guided)
-    for (int i = 0 ; i < numnodes ; i++) {
-        for (int j = 0 ; j < ga.size() ; j++) {
-            ga[j]->Range(
-                i,
-                radius,
-                omp_get_thread_num(),
-                dms[j][i]);
-        }
+    for (int i = 0 ; i < n ; i++) {
+        RangeResult range = nodesInRange(srcnodes ? srcnodes[i] : i, radius,
+                                         graphno, tmp);
+        visit(i, range, scratch);
+    }
     }
+}
+
+
+void
+Accessibility::precomputeRangeQueries(float radius, string engine) {
+    RangeEngine eng;
+    if (!findRangeEngine(engine, eng)) return;
+
+    dms.resize(ga.size());
+    for (int i = 0 ; i < ga.size() ; i++) {
+        dms[i].build(*ga[i], numnodes, radius, eng == RANGE_PHAST);
     }
     dmsradius = radius;
 }
 
 
-vector<vector<pair<long, float>>>
-Accessibility::Range(vector<long> srcnodes, float radius, int graphno, 
-                     vector<long> ext_ids) {
+void
+Accessibility::saveRangeQueries(std::string filename) {
+    vector<uint64_t> fingerprints(ga.size());
+    for (int i = 0 ; i < ga.size() ; i++) {
+        fingerprints[i] = ga[i]->fingerprint;
+    }
+    RangeCache::save(filename, dms, fingerprints, numnodes);
+}
+
+
+void
+Accessibility::loadRangeQueries(std::string filename) {
+    vector<uint64_t> fingerprints(ga.size());
+    for (int i = 0 ; i < ga.size() ; i++) {
+        fingerprints[i] = ga[i]->fingerprint;
+    }
+    RangeCache::load(filename, dms, fingerprints, numnodes);
+    dmsradius = dms[0].radius;
+}
+
+
+void
+Accessibility::saveContractionHierarchies(std::string filename) {
+    CHFile::save(filename, ga, numnodes);
+}
+
+
+void
+Accessibility::Range(vector<long> srcnodes, float radius, int graphno,
+                     vector<long> ext_ids, string engine,
+                     vector<long> &offsets, vector<long> &nodes,
+                     vector<float> &distances) {
+    offsets.clear();
+    nodes.clear();
+    distances.clear();
+    RangeEngine eng;
+    if (!findRangeEngine(engine, eng)) {
+        return;
+    }
 
     // Set up a mapping between the external node ids and internal ones
     std::unordered_map<long, int> int_ids(ext_ids.size());
@@ -96,55 +330,131 @@ Accessibility::Range(vector<long> srcnodes, float radius, int graphno,
     vector<DistanceVec> dists(srcnodes.size());
     if (dmsradius > 0 && radius <= dmsradius) {
         for (int i = 0; i < srcnodes.size(); i++) {
-            dists[i] = dms[graphno][int_ids[srcnodes[i]]];
+            RangeResult r = dms[graphno].get(int_ids[srcnodes[i]]);
+            dists[i].resize(r.size);
+            for (int j = 0; j < r.size; j++) {
+                dists[i][j] = std::make_pair(r.nodes[j], r.distances[j]);
+            }
+        }
+    }
+    else if (eng == RANGE_PHAST) {
+        vector<long> internal(srcnodes.size());
+        for (int i = 0; i < srcnodes.size(); i++) {
+            internal[i] = int_ids[srcnodes[i]];
         }
+        forEachRange(internal.size(), internal.data(), radius, graphno, eng,
+            [&](int i, const RangeResult &r, QuantileScratch &) {
+            dists[i].resize(r.size);
+            for (int j = 0; j < r.size; j++) {
+                dists[i][j] = std::make_pair(r.nodes[j], r.distances[j]);
+            }
+        });
     }
     else {
         #pragma omp parallel
         #pragma omp for schedule(guided)
         for (int i = 0; i < srcnodes.size(); i++) {
-            ga[graphno]->Range(int_ids[srcnodes[i]], radius,
-                omp_get_thread_num(), dists[i]);
+            ga[graphno]->Range(int_ids[srcnodes[i]], radius, dists[i]);
         }
     }
     
     // todo: check that results are returned from cache correctly
     // todo: check that performing an aggregation creates cache
 
-    // Convert back to external node ids
-    vector<vector<pair<long, float>>> output(dists.size());
+    // Convert back to external node ids, one source after the other
+    offsets.resize(dists.size() + 1);
+    offsets[0] = 0;
+    for (int i = 0; i < dists.size(); i++) {
+        offsets[i+1] = offsets[i] + dists[i].size();
+    }
+    nodes.resize(offsets.back());
+    distances.resize(offsets.back());
+    #pragma omp parallel for schedule(guided)
     for (int i = 0; i < dists.size(); i++) {
-        output[i].resize(dists[i].size());
         for (int j = 0; j < dists[i].size(); j++) {
-            output[i][j] = std::make_pair(ext_ids[dists[i][j].first], 
-                                          dists[i][j].second);
+            nodes[offsets[i] + j] = ext_ids[dists[i][j].first];
+            distances[offsets[i] + j] = dists[i][j].second;
         }
     }
-    return output;
 }
 
 
 vector<int>
 Accessibility::Route(int src, int tgt, int graphno) {
-    vector<NodeID> ret = this->ga[graphno]->Route(src, tgt);
-    return vector<int> (ret.begin(), ret.end());
+    // this takes the same route as Routes does, which can differ from
+    // Graphalg::Route when several routes are equally short
+    vector<vector<NodeID>> ret;
+    this->ga[graphno]->Routes(src, vector<NodeID>(1, tgt), ret);
+    return vector<int> (ret[0].begin(), ret[0].end());
+}
+
+
+void
+Accessibility::groupBySource(const vector<long> &sources, int n,
+                             vector<int> &order, vector<int> &groupStart) {
+    order.resize(n);
+    for (int i = 0 ; i < n ; i++) {
+        order[i] = i;
+    }
+    // trip tables are often sorted by origin already
+    if (!std::is_sorted(sources.begin(), sources.begin() + n)) {
+        std::stable_sort(order.begin(), order.end(),
+                         [&sources](int a, int b) {
+                             return sources[a] < sources[b];
+                         });
+    }
+
+    groupStart.clear();
+    for (int k = 0 ; k < n ; k++) {
+        if (k == 0 || sources[order[k]] != sources[order[k-1]]) {
+            groupStart.push_back(k);
+        }
+    }
+    groupStart.push_back(n);
 }
 
 
-vector<vector<int>>
-Accessibility::Routes(vector<long> sources, vector<long> targets, int graphno) {
+void
+Accessibility::Routes(vector<long> sources, vector<long> targets, int graphno,
+                      vector<long> &offsets, vector<long> &nodes) {
 
     int n = std::min(sources.size(), targets.size()); // in case lists don't match
-    vector<vector<int>> routes(n);
+    vector<vector<NodeID>> routes(n);
+
+    // the pairs sharing a source share its forward search
+    vector<int> order, groupStart;
+    groupBySource(sources, n, order, groupStart);
+    int numgroups = groupStart.size() - 1;
 
     #pragma omp parallel
-    #pragma omp for schedule(guided)
+    {
+    vector<NodeID> tgts;
+    vector<vector<NodeID>> paths;
+    #pragma omp for schedule(dynamic)
+    for (int g = 0 ; g < numgroups ; g++) {
+        int first = groupStart[g], last = groupStart[g+1];
+        long src = sources[order[first]];
+        tgts.clear();
+        for (int k = first ; k < last ; k++) {
+            tgts.push_back(targets[order[k]]);
+        }
+        this->ga[graphno]->Routes(src, tgts, paths);
+        for (int k = first ; k < last ; k++) {
+            routes[order[k]].swap(paths[k - first]);
+        }
+    }
+    }
+
+    offsets.resize(n + 1);
+    offsets[0] = 0;
+    for (int i = 0 ; i < n ; i++) {
+        offsets[i+1] = offsets[i] + routes[i].size();
+    }
+    nodes.resize(offsets.back());
     for (int i = 0 ; i < n ; i++) {
-        vector<NodeID> ret = this->ga[graphno]->Route(sources[i], targets[i], 
-            omp_get_thread_num());
-        routes[i] = vector<int> (ret.begin(), ret.end());
+        std::copy(routes[i].begin(), routes[i].end(),
+                  nodes.begin() + offsets[i]);
     }
-    return routes;
 }
 
 
@@ -159,14 +469,251 @@ Accessibility::Distances(vector<long> sources, vector<long> targets, int graphno
     
     int n = std::min(sources.size(), targets.size()); // in case lists don't match
     vector<double> distances(n);
-    
+
+    // the pairs sharing a source share its forward search
+    vector<int> order, groupStart;
+    groupBySource(sources, n, order, groupStart);
+    int numgroups = groupStart.size() - 1;
+
     #pragma omp parallel
+    {
+    vector<NodeID> tgts;
+    vector<double> dists;
+    #pragma omp for schedule(dynamic)
+    for (int g = 0 ; g < numgroups ; g++) {
+        int first = groupStart[g], last = groupStart[g+1];
+        long src = sources[order[first]];
+        if (last - first == 1) {
+            distances[order[first]] = this->ga[graphno]->Distance(
+                src, targets[order[first]]);
+            continue;
+        }
+
+        tgts.clear();
+        for (int k = first ; k < last ; k++) {
+            tgts.push_back(targets[order[k]]);
+        }
+        this->ga[graphno]->Distances(src, tgts, dists);
+        for (int k = first ; k < last ; k++) {
+            distances[order[k]] = dists[k - first];
+        }
+    }
+    }
+    return distances;
+}
+
+
+void
+Accessibility::DistanceMatrix(vector<long> sources, vector<long> targets,
+                              float *matrix, int graphno) {
+    int n = sources.size();
+    int m = targets.size();
+
+    // the backward searches from the targets fill the buckets, and then
+    // each thread takes rows of the matrix in turn
+    vector<vector<CH::BucketEntry>> searchSpaces(m);
+    #pragma omp parallel
+    #pragma omp for schedule(guided)
+    for (int j = 0 ; j < m ; j++) {
+        ga[graphno]->BackwardSearchSpace(targets[j], searchSpaces[j]);
+    }
+
+    CH::ManyToManyBuckets buckets;
+    buckets.Build(numnodes, searchSpaces);
+
+    // on a twoway graph the distance from one target to another is the
+    // same both ways, so if the sources are the targets only the upper
+    // triangle is computed, straight from the search spaces found above,
+    // and then mirrored
+    if (ga[graphno]->twoway && sources == targets) {
+        #pragma omp parallel
+        {
+        vector<EdgeWeight> scratch;
+        #pragma omp for schedule(dynamic, 16)
+        for (int i = 0 ; i < n ; i++) {
+            ga[graphno]->DistancesFromSearchSpace(
+                searchSpaces[i], buckets, i, scratch,
+                matrix + static_cast<size_t>(i) * m);
+        }
+        }
+
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0 ; i < n ; i++) {
+            for (int j = 0 ; j < i ; j++) {
+                matrix[static_cast<size_t>(i) * m + j] =
+                    matrix[static_cast<size_t>(j) * m + i];
+            }
+        }
+        return;
+    }
+    vector<vector<CH::BucketEntry>>().swap(searchSpaces);
+
+    #pragma omp parallel
+    {
+    vector<EdgeWeight> scratch;
     #pragma omp for schedule(guided)
     for (int i = 0 ; i < n ; i++) {
-        distances[i] = this->ga[graphno]->Distance(
-            sources[i], 
-            targets[i], 
-            omp_get_thread_num());
+        ga[graphno]->DistancesFromBuckets(sources[i], buckets, scratch,
+                                          matrix + static_cast<size_t>(i) * m);
+    }
+    }
+}
+
+
+void
+Accessibility::writeSkim(vector<long> sources, vector<long> targets,
+                         string filename, int tileSize, double memoryBudget,
+                         int graphno) {
+    if (tileSize <= 0) {
+        throw std::runtime_error("the tile size must be positive");
+    }
+    Graphalg &g = *ga[graphno];
+
+    SkimLayout layout;
+    layout.numrows = sources.size();
+    layout.numcols = targets.size();
+    layout.tileRows = tileSize;
+    layout.tileCols = tileSize;
+    layout.fingerprint = g.fingerprint;
+    SkimWriter writer(filename, layout, sources, targets);
+
+    // on a twoway graph a skim from a set of nodes to itself is symmetric,
+    // so only the tiles on and above the diagonal are computed, and each
+    // of them is also written transposed as the tile below the diagonal
+    bool symmetric = g.twoway && sources == targets;
+
+    // a tile in flight holds its cells and, at worst, 5 bytes a cell once
+    // encoded - twice over if it's also transposed
+    double tileBytes = static_cast<double>(tileSize) * tileSize *
+        (sizeof(EdgeWeight) + 5) * (symmetric ? 2 : 1);
+
+    for (uint64_t ct = 0 ; ct < layout.numColTiles() ; ct++) {
+        vector<uint64_t> todo;
+        for (uint64_t rt = 0 ; rt < layout.numRowTiles() ; rt++) {
+            if (symmetric ? rt <= ct && (!writer.done(rt, ct) ||
+                                         !writer.done(ct, rt))
+                          : !writer.done(rt, ct)) {
+                todo.push_back(rt);
+            }
+        }
+        if (todo.empty()) continue;
+
+        int colFirst = ct * tileSize;
+        int cols = std::min<uint64_t>(tileSize, layout.numcols - colFirst);
+
+        vector<vector<CH::BucketEntry>> searchSpaces(cols);
+        #pragma omp parallel
+        #pragma omp for schedule(guided)
+        for (int j = 0 ; j < cols ; j++) {
+            g.BackwardSearchSpace(targets[colFirst + j], searchSpaces[j]);
+        }
+        CH::ManyToManyBuckets buckets;
+        buckets.Build(numnodes, searchSpaces);
+        vector<vector<CH::BucketEntry>>().swap(searchSpaces);
+
+        double bucketBytes = buckets.firstEntry.size() * sizeof(unsigned) +
+            buckets.entries.size() * sizeof(CH::BucketEntry);
+        int inFlight = std::min<double>(todo.size(), std::max(
+            1.0, (memoryBudget * 1024 * 1024 - bucketBytes) / tileBytes));
+
+        // the tiles of a batch are computed in parallel, then written in
+        // order so that a run which stops loses at most one batch
+        for (int first = 0 ; first < todo.size() ; first += inFlight) {
+            int last = std::min<int>(todo.size(), first + inFlight);
+            vector<vector<char>> encoded(last - first);
+            vector<vector<char>> transposed(last - first);
+
+            #pragma omp parallel
+            {
+            vector<EdgeWeight> cells, flipped;
+            vector<CH::BucketEntry> searchSpace;
+            #pragma omp for schedule(dynamic)
+            for (int k = first ; k < last ; k++) {
+                int rowFirst = todo[k] * tileSize;
+                int rows = std::min<uint64_t>(tileSize,
+                                              layout.numrows - rowFirst);
+                bool diagonal = symmetric && todo[k] == ct;
+                cells.resize(static_cast<size_t>(rows) * cols);
+                for (int i = 0 ; i < rows ; i++) {
+                    EdgeWeight *row = cells.data() +
+                        static_cast<size_t>(i) * cols;
+                    if (symmetric) {
+                        // the search space of the source serves both ways,
+                        // and on the diagonal the cells below it are
+                        // mirrored afterwards
+                        g.BackwardSearchSpace(sources[rowFirst + i],
+                                              searchSpace);
+                        buckets.Scan(searchSpace, row, diagonal ? i : 0);
+                    } else {
+                        g.DistancesFromBuckets(sources[rowFirst + i],
+                                               buckets, row);
+                    }
+                }
+                if (diagonal) {
+                    for (int i = 0 ; i < rows ; i++) {
+                        for (int j = 0 ; j < i ; j++) {
+                            cells[i * cols + j] = cells[j * cols + i];
+                        }
+                    }
+                }
+                SkimWriter::encode(cells.data(), cells.size(),
+                                   encoded[k - first]);
+
+                if (symmetric && !diagonal) {
+                    flipped.resize(cells.size());
+                    for (int i = 0 ; i < rows ; i++) {
+                        for (int j = 0 ; j < cols ; j++) {
+                            flipped[j * rows + i] = cells[i * cols + j];
+                        }
+                    }
+                    SkimWriter::encode(flipped.data(), flipped.size(),
+                                       transposed[k - first]);
+                }
+            }
+            }
+
+            for (int k = first ; k < last ; k++) {
+                if (!writer.done(todo[k], ct)) {
+                    writer.write(todo[k], ct, encoded[k - first]);
+                }
+                if (symmetric && todo[k] != ct && !writer.done(ct, todo[k])) {
+                    writer.write(ct, todo[k], transposed[k - first]);
+                }
+            }
+        }
+    }
+}
+
+
+void Accessibility::initializeTargetSet(string name, vector<long> node_idx) {
+    vector<NodeID> targets(node_idx.begin(), node_idx.end());
+    for (int i = 0 ; i < ga.size() ; i++) {
+        ga[i]->initTargetSet(name, targets);
+    }
+}
+
+
+vector<double>
+Accessibility::getDistancesToTargets(vector<long> srcnodes, string name,
+                                     int graphno) {
+    int numtargets = ga[graphno]->TargetSetSize(name);
+    if (numtargets < 0) return vector<double>();
+
+    int n = srcnodes.size();
+    int numbatches = (n + PHAST_BATCH - 1) / PHAST_BATCH;
+    vector<double> distances(size_t(n) * numtargets);
+
+    #pragma omp parallel
+    {
+    vector<NodeID> batch;
+    #pragma omp for schedule(guided)
+    for (int b = 0 ; b < numbatches ; b++) {
+        int start = b * PHAST_BATCH;
+        int end = std::min(n, start + PHAST_BATCH);
+        batch.assign(srcnodes.begin() + start, srcnodes.begin() + end);
+        ga[graphno]->DistancesToTargets(name, batch,
+                                        &distances[size_t(start) * numtargets]);
+    }
     }
     return distances;
 }
@@ -182,9 +729,6 @@ POI QUERIES
 void Accessibility::initializeCategory(const double maxdist, const int maxitems,
                                        string category, vector<long> node_idx)
 {
-    accessibility_vars_t av;
-    av.resize(this->numnodes);
-
     this->maxdist = maxdist;
     this->maxitems = maxitems;
 
@@ -193,14 +737,17 @@ void Accessibility::initializeCategory(const double maxdist, const int maxitems,
         ga[i]->initPOIIndex(category, this->maxdist, this->maxitems);
         // initialize for each node
         for (int j = 0 ; j < node_idx.size() ; j++) {
-            int node_id = node_idx[j];
-
-            ga[i]->addPOIToIndex(category, node_id);
-            assert(node_id << av.size());
-            av[node_id].push_back(j);
+            ga[i]->addPOIToIndex(category, node_idx[j]);
         }
     }
-    accessibilityVarsForPOIs[category] = av;
+
+    // the value of each poi is its index, so they can be reported back
+    vector<double> poi_ids(node_idx.size());
+    for (int j = 0 ; j < node_idx.size() ; j++) {
+        poi_ids[j] = j;
+    }
+    accessibilityVarsForPOIs[category] =
+        accessibility_vars_t(numnodes, node_idx, poi_ids);
 }
 
 
@@ -213,7 +760,7 @@ Accessibility::findNearestPOIs(int srcnode, float maxradius, unsigned number,
                                string cat, int gno)
 {
     DistanceMap distancesmap = ga[gno]->NearestPOI(cat, srcnode,
-        maxradius, number, omp_get_thread_num());
+        maxradius, number);
 
     vector<distance_node_pair> distance_node_pairs;
     std::map<POIKeyType, accessibility_vars_t>::iterator cat_for_pois = 
@@ -231,9 +778,9 @@ Accessibility::findNearestPOIs(int srcnode, float maxradius, unsigned number,
       int nodeid = itDist->first;
       double distance = itDist->second;
 
-      for (int i = 0 ; i < vars[nodeid].size() ; i++) {
-          distance_node_pairs.push_back(
-             make_pair(distance, vars[nodeid][i]));
+      for (const float *poi = vars.begin(nodeid) ; poi != vars.end(nodeid) ;
+           ++poi) {
+          distance_node_pairs.push_back(make_pair(distance, *poi));
       }
     }
 
@@ -245,16 +792,11 @@ Accessibility::findNearestPOIs(int srcnode, float maxradius, unsigned number,
 
 
 /* the return_nodeds param is described above */
-pair<vector<vector<double>>, vector<vector<int>>>
+void
 Accessibility::findAllNearestPOIs(float maxradius, unsigned num_of_pois,
-                                  string category,int gno)
+                                  string category, double *dists,
+                                  long *poi_ids, int gno)
 {
-    vector<vector<double>>
-        dists(numnodes, vector<double> (num_of_pois));
-
-    vector<vector<int>>
-        poi_ids(numnodes, vector<int> (num_of_pois));
-
     #pragma omp parallel for
     for (int i = 0 ; i < numnodes ; i++) {
         vector<pair<double, int>> d = findNearestPOIs(
@@ -263,17 +805,18 @@ Accessibility::findAllNearestPOIs(float maxradius, unsigned num_of_pois,
             num_of_pois,
             category,
             gno);
+        double *row = dists + size_t(i) * num_of_pois;
+        long *ids = poi_ids + size_t(i) * num_of_pois;
         for (int j = 0 ; j < num_of_pois ; j++) {
             if (j < d.size()) {
-                dists[i][j] = d[j].first;
-                poi_ids[i][j] = d[j].second;
+                row[j] = d[j].first;
+                ids[j] = d[j].second;
             } else {
-                dists[i][j] = -1;
-                poi_ids[i][j] = -1;
+                row[j] = -1;
+                ids[j] = -1;
             }
         }
     }
-    return make_pair(dists, poi_ids);
 }
 
 
@@ -287,17 +830,222 @@ AGGREGATION/ACCESSIBILITY QUERIES
 void Accessibility::initializeAccVar(
     string category,
     vector<long> node_idx,
-    vector<double> values) {
-    accessibility_vars_t av;
-    av.resize(this->numnodes);
-    for (int i = 0 ; i < node_idx.size() ; i++) {
-        int node_id = node_idx[i];
-        double val = values[i];
+    vector<double> values,
+    int quantileBins) {
+    accessibilityVars[category] =
+        accessibility_vars_t(numnodes, node_idx, values, quantileBins);
+}
 
-        assert(node_id << av.size());
-        av[node_id].push_back(val);
+
+// the weight of an item at distance from the source - D is a constant so
+// this folds away inside the kernels
+template <DecayType D>
+static inline double decayWeight(double distance, float radius) {
+    switch (D) {
+    case DECAY_EXP: return exp(-1*distance/radius);
+    case DECAY_LINEAR: return 1.0-distance/radius;
+    default: return 1.0;
+    }
+}
+
+
+// add the items at a node at distance from the source to the stats of
+// all the items reached - only what A needs is kept up to date
+template <AggregationType A, DecayType D>
+static inline void
+addNodeStats(NodeStats &reached, const NodeStats &stats, double distance,
+             float radius) {
+    // stddev is always flat
+    const DecayType decay = A == AGG_STD ? DECAY_FLAT : D;
+
+    reached.count += stats.count;
+    if (A == AGG_MIN) {
+        reached.min = std::min(reached.min, stats.min);
+    } else if (A == AGG_MAX) {
+        reached.max = std::max(reached.max, stats.max);
+    } else if (A != AGG_COUNT) {
+        reached.sum += decayWeight<decay>(distance, radius) * stats.sum;
+        if (A == AGG_STD) reached.sumsq += stats.sumsq;
+    }
+}
+
+
+// the aggregation of all the items reached
+template <AggregationType A>
+static inline double
+finishAggregation(const NodeStats &reached) {
+    int cnt = reached.count;
+
+    // as for the quantiles, there's no min or max of nothing
+    if (A == AGG_MIN) return cnt == 0 ? -1 : reached.min;
+    if (A == AGG_MAX) return cnt == 0 ? -1 : reached.max;
+
+    if (A == AGG_COUNT) return cnt;
+
+    double sum = reached.sum;
+    if (A == AGG_MEAN && cnt != 0) sum /= cnt;
+
+    if (A == AGG_STD && cnt != 0) {
+        double mean = sum / cnt;
+        return sqrt(reached.sumsq / cnt - mean * mean);
     }
-    accessibilityVars[category] = av;
+
+    return sum;
+}
+
+
+template <AggregationType A, DecayType D>
+double
+Accessibility::aggregateAccessibilityVariable(
+    const RangeResult &range,
+    float radius,
+    const accessibility_vars_t &vars,
+    QuantileScratch &scratch) {
+    if (range.size == 0) return -1;
+
+    // nodes come out of the range query in the order they were settled,
+    // i.e. sorted by distance, so the nodes within radius are a prefix of
+    // a search to a larger radius (which happens when it was precomputed)
+    RangeResult r = range;
+    r.size = std::upper_bound(range.distances, range.distances + range.size,
+                              radius) - range.distances;
+
+    switch (A) {
+    case AGG_25PCT: return quantileAccessibilityVariable(
+        r, vars, 0.25, scratch);
+    case AGG_MEDIAN: return quantileAccessibilityVariable(
+        r, vars, 0.5, scratch);
+    case AGG_75PCT: return quantileAccessibilityVariable(
+        r, vars, 0.75, scratch);
+    default: break;
+    }
+
+    // the rest only need the stats of each node
+    NodeStats reached = emptyNodeStats();
+    for (int i = 0 ; i < r.size ; i++) {
+        addNodeStats<A, D>(reached, vars.stats(r.nodes[i]), r.distances[i],
+                           radius);
+    }
+    return finishAggregation<A>(reached);
+}
+
+
+template <AggregationType A, DecayType D>
+void
+Accessibility::scatterAccessibilityVariable(
+    Graphalg &g,
+    float radius,
+    const accessibility_vars_t &vars,
+    vector<double> &scores) {
+    int numnodes = scores.size();
+    const vector<int> &occupied = vars.occupiedNodes();
+
+    // every thread has the stats of everything reached from each source,
+    // for the part of the occupied nodes it searched from - there's one for
+    // each thread of the team, which may be fewer than asked for
+    vector<vector<NodeStats> > acc;
+
+    #pragma omp parallel num_threads(scatterThreads(numnodes))
+    {
+    #pragma omp single
+    acc.resize(omp_get_num_threads());
+
+    vector<NodeStats> &mine = acc[omp_get_thread_num()];
+    mine.assign(numnodes, emptyNodeStats());
+    RangeBuffer tmp;
+
+    #pragma omp for schedule(guided)
+    for (int i = 0 ; i < occupied.size() ; i++) {
+        int nodeid = occupied[i];
+        tmp.nodes.clear();
+        tmp.distances.clear();
+        g.ReverseRange(nodeid, radius, tmp.nodes, tmp.distances);
+
+        // cut at radius the same way as the pull kernels
+        RangeResult r = tmp.result();
+        r.size = std::upper_bound(r.distances, r.distances + r.size,
+                                  radius) - r.distances;
+
+        const NodeStats &stats = vars.stats(nodeid);
+        for (int j = 0 ; j < r.size ; j++) {
+            addNodeStats<A, D>(mine[r.nodes[j]], stats, r.distances[j],
+                               radius);
+        }
+    }
+
+    // the implied barrier means all the threads are done, so the sources
+    // can be split up again to merge the threads
+    #pragma omp for schedule(static)
+    for (int i = 0 ; i < numnodes ; i++) {
+        NodeStats reached = acc[0][i];
+        for (int t = 1 ; t < acc.size() ; t++) {
+            addNodeStats<A, DECAY_FLAT>(reached, acc[t][i], 0, radius);
+        }
+        scores[i] = finishAggregation<A>(reached);
+    }
+    }
+}
+
+
+// compile the kernels for all the decays of an aggregation type
+#define AGGREGATION_KERNELS(A) \
+    { &Accessibility::aggregateAccessibilityVariable<A, DECAY_EXP>, \
+      &Accessibility::aggregateAccessibilityVariable<A, DECAY_LINEAR>, \
+      &Accessibility::aggregateAccessibilityVariable<A, DECAY_FLAT> }
+
+Accessibility::AggregationKernel
+Accessibility::findAggregationKernel(string aggtyp, string decay) {
+    static const AggregationKernel kernels[][3] = {
+        AGGREGATION_KERNELS(AGG_SUM),
+        AGGREGATION_KERNELS(AGG_MEAN),
+        AGGREGATION_KERNELS(AGG_MIN),
+        AGGREGATION_KERNELS(AGG_25PCT),
+        AGGREGATION_KERNELS(AGG_MEDIAN),
+        AGGREGATION_KERNELS(AGG_75PCT),
+        AGGREGATION_KERNELS(AGG_MAX),
+        AGGREGATION_KERNELS(AGG_STD),
+        AGGREGATION_KERNELS(AGG_COUNT)
+    };
+
+    int a, d;
+    if (!findAggregationType(aggtyp, decay, a, d)) return NULL;
+    return kernels[a][d];
+}
+
+
+#define SCATTER_KERNELS(A) \
+    { &Accessibility::scatterAccessibilityVariable<A, DECAY_EXP>, \
+      &Accessibility::scatterAccessibilityVariable<A, DECAY_LINEAR>, \
+      &Accessibility::scatterAccessibilityVariable<A, DECAY_FLAT> }
+
+Accessibility::ScatterKernel
+Accessibility::findScatterKernel(string aggtyp, string decay) {
+    // the quantiles need all the items of a source at once
+    static const ScatterKernel kernels[][3] = {
+        SCATTER_KERNELS(AGG_SUM),
+        SCATTER_KERNELS(AGG_MEAN),
+        SCATTER_KERNELS(AGG_MIN),
+        { NULL, NULL, NULL },
+        { NULL, NULL, NULL },
+        { NULL, NULL, NULL },
+        SCATTER_KERNELS(AGG_MAX),
+        SCATTER_KERNELS(AGG_STD),
+        SCATTER_KERNELS(AGG_COUNT)
+    };
+
+    int a, d;
+    if (!findAggregationType(aggtyp, decay, a, d)) return NULL;
+    return kernels[a][d];
+}
+
+
+bool
+Accessibility::findAggregationType(string aggtyp, string decay, int &a,
+                                   int &d) {
+    a = std::find(aggregations.begin(), aggregations.end(), aggtyp) -
+        aggregations.begin();
+    d = std::find(decays.begin(), decays.end(), decay) - decays.begin();
+    return a < aggregations.size() && d < decays.size();
 }
 
 
@@ -307,166 +1055,265 @@ Accessibility::getAllAggregateAccessibilityVariables(
     string category,
     string aggtyp,
     string decay,
-    int graphno) {
-    if (accessibilityVars.find(category) == accessibilityVars.end() ||
-        std::find(aggregations.begin(), aggregations.end(), aggtyp)
-            == aggregations.end() ||
-        std::find(decays.begin(), decays.end(), decay) == decays.end()) {
+    int graphno,
+    string engine) {
+    AggregationKernel kernel = findAggregationKernel(aggtyp, decay);
+    RangeEngine eng;
+    if (kernel == NULL || !findRangeEngine(engine, eng) ||
+        accessibilityVars.find(category) == accessibilityVars.end()) {
         // not found
         return vector<double>();
     }
 
     vector<double> scores(numnodes);
+    accessibility_vars_t &vars = accessibilityVars[category];
+
+    // when few nodes have the variable it's cheaper to search backwards
+    // from each of them and push their items to the sources which reach
+    // them, unless the searches from every source were precomputed - on a
+    // large graph fewer threads can push than pull, so fewer nodes may have it
+    ScatterKernel scatter = findScatterKernel(aggtyp, decay);
+    bool precomputed = dmsradius > 0 && radius <= dmsradius;
+    double share = static_cast<double>(scatterThreads(numnodes)) /
+        omp_get_max_threads();
+    if (scatter != NULL && eng == RANGE_DIJKSTRA && !precomputed &&
+        vars.occupiedNodes().size() < numnodes * SCATTER_OCCUPANCY * share) {
+        scatter(*ga[graphno], radius, vars, scores);
+        return scores;
+    }
 
-    #pragma omp parallel
-    {
-    #pragma omp for schedule(guided)
-    for (int i = 0 ; i < numnodes ; i++) {
-        scores[i] = aggregateAccessibilityVariable(
-            i,
-            radius,
-            accessibilityVars[category],
-            aggtyp,
-            decay,
-            graphno);
+    forEachRange(numnodes, NULL, radius, graphno, eng,
+        [&](int i, const RangeResult &range, QuantileScratch &scratch) {
+        scores[i] = kernel(range, radius, vars, scratch);
+    });
+    return scores;
+}
+
+
+vector<double>
+Accessibility::getAggregateAccessibilityVariables(
+    vector<long> srcnodes,
+    float radius,
+    string category,
+    string aggtyp,
+    string decay,
+    int graphno,
+    string engine) {
+    AggregationKernel kernel = findAggregationKernel(aggtyp, decay);
+    RangeEngine eng;
+    if (kernel == NULL || !findRangeEngine(engine, eng) ||
+        accessibilityVars.find(category) == accessibilityVars.end()) {
+        // not found
+        return vector<double>();
+    }
+
+    vector<double> scores(srcnodes.size());
+    accessibility_vars_t &vars = accessibilityVars[category];
+
+    forEachRange(srcnodes.size(), srcnodes.data(), radius, graphno, eng,
+        [&](int i, const RangeResult &range, QuantileScratch &scratch) {
+        scores[i] = kernel(range, radius, vars, scratch);
+    });
+    return scores;
+}
+
+
+vector<double>
+Accessibility::getAggregateAccessibilityVariables(
+    vector<long> srcnodes,
+    vector<float> radii,
+    string category,
+    string aggtyp,
+    string decay,
+    int graphno,
+    string engine) {
+    AggregationKernel kernel = findAggregationKernel(aggtyp, decay);
+    RangeEngine eng;
+    if (kernel == NULL || !findRangeEngine(engine, eng) || radii.empty() ||
+        accessibilityVars.find(category) == accessibilityVars.end()) {
+        // not found
+        return vector<double>();
     }
+
+    size_t n = srcnodes.size();
+    vector<double> scores(radii.size() * n);
+    float maxradius = *std::max_element(radii.begin(), radii.end());
+    accessibility_vars_t &vars = accessibilityVars[category];
+
+    forEachRange(n, srcnodes.data(), maxradius, graphno, eng,
+        [&](int i, const RangeResult &range, QuantileScratch &scratch) {
+        // as for every node, the search at the largest radius is cut down
+        // to each of the smaller ones
+        for (int k = 0 ; k < radii.size() ; k++) {
+            scores[k * n + i] = kernel(range, radii[k], vars, scratch);
+        }
+    });
+    return scores;
+}
+
+
+vector<double>
+Accessibility::getAllAggregateAccessibilityVariables(
+    vector<float> radii,
+    string category,
+    string aggtyp,
+    string decay,
+    int graphno,
+    string engine) {
+    AggregationKernel kernel = findAggregationKernel(aggtyp, decay);
+    RangeEngine eng;
+    if (kernel == NULL || !findRangeEngine(engine, eng) || radii.empty() ||
+        accessibilityVars.find(category) == accessibilityVars.end()) {
+        // not found
+        return vector<double>();
     }
+
+    vector<double> scores(radii.size() * numnodes);
+    float maxradius = *std::max_element(radii.begin(), radii.end());
+    accessibility_vars_t &vars = accessibilityVars[category];
+
+    forEachRange(numnodes, NULL, maxradius, graphno, eng,
+        [&](int i, const RangeResult &range, QuantileScratch &scratch) {
+        // the kernel cuts the search at the largest radius down to each
+        // of the smaller ones
+        for (int k = 0 ; k < radii.size() ; k++) {
+            scores[size_t(k) * numnodes + i] =
+                kernel(range, radii[k], vars, scratch);
+        }
+    });
     return scores;
 }
 
 
-double
-Accessibility::quantileAccessibilityVariable(
-    DistanceVec &distances,
-    accessibility_vars_t &vars,
+vector<double>
+Accessibility::getManyAggregateAccessibilityVariables(
+    float radius,
+    vector<string> categories,
+    vector<string> aggtyps,
+    vector<string> decays,
+    int graphno,
+    string engine) {
+    // in case lists don't match
+    int n = std::min(categories.size(),
+                     std::min(aggtyps.size(), decays.size()));
+
+    vector<double> scores(size_t(n) * numnodes,
+                          std::numeric_limits<double>::quiet_NaN());
+    RangeEngine eng;
+    if (!findRangeEngine(engine, eng)) return scores;
+
+    // look up the variables and kernels once rather than for every node
+    vector<accessibility_vars_t *> vars(n, NULL);
+    vector<AggregationKernel> kernels(n, NULL);
+    for (int k = 0 ; k < n ; k++) {
+        kernels[k] = findAggregationKernel(aggtyps[k], decays[k]);
+        if (kernels[k] == NULL ||
+            accessibilityVars.find(categories[k]) == accessibilityVars.end())
+            continue;
+        vars[k] = &accessibilityVars[categories[k]];
+    }
+
+    forEachRange(numnodes, NULL, radius, graphno, eng,
+        [&](int i, const RangeResult &range, QuantileScratch &scratch) {
+        // every aggregation is fed from the same range query
+        for (int k = 0 ; k < n ; k++) {
+            if (vars[k] == NULL) continue;
+            scores[size_t(k) * numnodes + i] =
+                kernels[k](range, radius, *vars[k], scratch);
+        }
+    });
+    return scores;
+}
+
+
+// a quantile from the sketches of the nodes of a range query - the counts
+// of the sketches are merged and the bin holding the quantile is found
+static double
+sketchQuantile(
+    const RangeResult &range,
+    const AccessibilityVars &vars,
     float quantile,
-    float radius) {
+    vector<int> &binCounts) {
+    binCounts.assign(vars.quantileBins, 0);
 
-    // first iterate through nodes in order to get count of items
     int cnt = 0;
+    for (int i = 0 ; i < range.size ; i++) {
+        int nodeid = range.nodes[i];
+        for (const BinCount *bc = vars.binsBegin(nodeid) ;
+             bc != vars.binsEnd(nodeid) ; ++bc) {
+            binCounts[bc->bin] += bc->count;
+        }
+        cnt += vars.count(nodeid);
+    }
 
-    for (int i = 0 ; i < distances.size() ; i++) {
-        int nodeid = distances[i].first;
-        double distance = distances[i].second;
+    if (cnt == 0) return -1;
 
-        if (distance > radius) continue;
+    int ind = static_cast<int>(cnt * quantile);
+    if (ind >= cnt) ind = cnt-1;
 
-        cnt += vars[nodeid].size();
+    int bin = 0;
+    for (int seen = binCounts[0] ; seen <= ind ; seen += binCounts[bin]) {
+        bin++;
     }
+    return vars.binMin + (bin + 0.5) * vars.binWidth;
+}
 
-    if (cnt == 0) return -1;
 
-    vector<float> vals(cnt);
+double
+Accessibility::quantileAccessibilityVariable(
+    const RangeResult &range,
+    const accessibility_vars_t &vars,
+    float quantile,
+    QuantileScratch &scratch) {
 
-    // make a second pass to put items in a single array for sorting
-    for (int i = 0, cnt = 0 ; i < distances.size() ; i++) {
-        int nodeid = distances[i].first;
-        double distance = distances[i].second;
+    if (vars.sketched()) {
+        return sketchQuantile(range, vars, quantile, scratch.binCounts);
+    }
 
-        if (distance > radius) continue;
+    // first iterate through nodes in order to get count of items
+    int cnt = 0;
 
-        // and then iterate through all items at the node
-        for (int j = 0 ; j < vars[nodeid].size() ; j++)
-            vals[cnt++] = vars[nodeid][j];
+    for (int i = 0 ; i < range.size ; i++) {
+        cnt += vars.count(range.nodes[i]);
     }
 
-    std::sort(vals.begin(), vals.end());
+    if (cnt == 0) return -1;
+
+    // make a second pass to put items in a single array and select the
+    // quantile from it
+    vector<float> &vals = scratch.values;
+    vals.resize(cnt);
+    float *val = vals.data();
+    for (int i = 0 ; i < range.size ; i++) {
+        int nodeid = range.nodes[i];
+        val = std::copy(vars.begin(nodeid), vars.end(nodeid), val);
+    }
 
     int ind = static_cast<int>(vals.size() * quantile);
 
     if (quantile <= 0.0) ind = 0;
     if (quantile >= 1.0) ind = vals.size()-1;
 
+    std::nth_element(vals.begin(), vals.begin() + ind, vals.end());
     return vals[ind];
 }
 
 
-double
-Accessibility::aggregateAccessibilityVariable(
-    int srcnode,
-    float radius,
-    accessibility_vars_t &vars,
-    string aggtyp,
-    string decay,
-    int gno) {
-    // I don't know if this is the best way to do this but I
-    // I don't want to copy memory in the precompute case - sometimes
-    // I need a reference and sometimes not
-    DistanceVec tmp;
-    DistanceVec &distances = tmp;
+RangeResult
+Accessibility::nodesInRange(int srcnode, float radius, int gno,
+                            RangeBuffer &tmp) {
+    // I don't want to copy memory in the precompute case
     if (dmsradius > 0 && radius <= dmsradius) {
-        distances = dms[gno][srcnode];
-    } else {
-        ga[gno]->Range(
-            srcnode,
-            radius,
-            omp_get_thread_num(),
-            tmp);
-    }
-
-    if (distances.size() == 0) return -1;
-
-    if (aggtyp == "min") {
-        return this->quantileAccessibilityVariable(
-            distances, vars, 0.0, radius);
-    } else if (aggtyp == "25pct") {
-        return this->quantileAccessibilityVariable(
-            distances, vars, 0.25, radius);
-    } else if (aggtyp == "median") {
-        return this->quantileAccessibilityVariable(
-            distances, vars, 0.5, radius);
-    } else if (aggtyp == "75pct") {
-        return this->quantileAccessibilityVariable(
-            distances, vars, 0.75, radius);
-    } else if (aggtyp == "max") {
-        return this->quantileAccessibilityVariable(
-            distances, vars, 1.0, radius);
-    }
-
-    if (aggtyp == "std") decay = "flat";
-
-    int cnt = 0;
-    double sum = 0.0;
-    double sumsq = 0.0;
-
-    std::function<double(const double &, const float &, const float &)> sum_function;
-
-    if(decay == "exp")
-        sum_function = [](const double &distance, const float &radius, const float &var)
-                        { return exp(-1*distance/radius) * var; };
-    if(decay == "linear")
-        sum_function = [](const double &distance, const float &radius, const float &var)
-                        { return (1.0-distance/radius) * var; };
-    if(decay == "flat")
-        sum_function = [](const double &distance, const float &radius, const float &var)
-                        { return var; };
-
-    for (int i = 0 ; i < distances.size() ; i++) {
-        int nodeid = distances[i].first;
-        double distance = distances[i].second;
-
-        // this can now happen since we're precomputing
-        if (distance > radius) continue;
-
-        for (int j = 0 ; j < vars[nodeid].size() ; j++) {
-            cnt++;  // count items
-            sum += sum_function(distance, radius, vars[nodeid][j]);
-
-            // stddev is always flat
-            sumsq += vars[nodeid][j] * vars[nodeid][j];
-        }
+        return dms[gno].get(srcnode);
     }
-
-    if (aggtyp == "count") return cnt;
-
-    if (aggtyp == "mean" && cnt != 0) sum /= cnt;
-
-    if (aggtyp == "std" && cnt != 0) {
-        double mean = sum / cnt;
-        return sqrt(sumsq / cnt - mean * mean);
-    }
-
-    return sum;
+    tmp.nodes.clear();
+    tmp.distances.clear();
+    ga[gno]->Range(
+        srcnode,
+        radius,
+        tmp.nodes,
+        tmp.distances);
+    return tmp.result();
 }
 
 }  // namespace accessibility
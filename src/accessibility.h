@@ -8,6 +8,10 @@
 #include <map>
 #include "shared.h"
 #include "graphalg.h"
+#include "rangecache.h"
+#include "accessibilityvars.h"
+#include "skim.h"
+#include "chfile.h"
 
 namespace MTC {
 namespace accessibility {
@@ -17,24 +21,51 @@ using std::string;
 using std::set;
 using std::map;
 
+// the aggregation and decay types, in the same order as the aggregations
+// and decays of Accessibility
+enum AggregationType {
+    AGG_SUM, AGG_MEAN, AGG_MIN, AGG_25PCT, AGG_MEDIAN, AGG_75PCT,
+    AGG_MAX, AGG_STD, AGG_COUNT
+};
+enum DecayType { DECAY_EXP, DECAY_LINEAR, DECAY_FLAT };
+
+// the ways of running range queries, in the same order as the engines of
+// Accessibility - a dijkstra search of the network around the source, or
+// a PHAST sweep of the whole contracted graph which is faster when the
+// radius covers much of the network
+enum RangeEngine { RANGE_DIJKSTRA, RANGE_PHAST };
+
 class Accessibility {
  public:
+    // edges is numedges rows of (from, to) node indexes and edgeweights
+    // numgraphs rows of numedges weights, one row per graph - both are
+    // read in place, and only need to last as long as the constructor
     Accessibility(
         int numnodes,
-        vector< vector<long> > edges,
-        vector< vector<double> >  edgeweights,
-        bool twoway);
+        const long *edges,
+        int numedges,
+        const double *edgeweights,
+        int numgraphs,
+        bool twoway,
+        string hierarchy = "ch",
+        string chFile = "");
 
     // initialize the category number with POIs at the node_id locations
     void initializeCategory(const double maxdist, const int maxitems, string category, vector<long> node_idx);
 
-    // find the nearest pois for all nodes in the network
-    pair<vector<vector<double>>, vector<vector<int>>>
-    findAllNearestPOIs(float maxradius, unsigned maxnumber,
-                       string category, int graphno = 0);
+    // find the nearest pois for all nodes in the network - the distances
+    // to the maxnumber nearest of each node and the indexes of those pois
+    // are written row by row to distances and poiIds, which must have room
+    // for numnodes * maxnumber values, with -1 where there are fewer pois
+    void findAllNearestPOIs(float maxradius, unsigned maxnumber,
+                            string category, double *distances,
+                            long *poiIds, int graphno = 0);
 
+    // quantileBins > 0 also builds a sketch with that many bins, which
+    // the quantile aggregations of the variable then use to return
+    // approximate results quickly - see AccessibilityVars
     void initializeAccVar(string category, vector<long> node_idx,
-                          vector<double> values);
+                          vector<double> values, int quantileBins = 0);
 
     // computes the accessibility for every node in the network
     vector<double>
@@ -43,18 +74,77 @@ class Accessibility {
         string index,
         string aggtyp,
         string decay,
-        int graphno = 0);
+        int graphno = 0,
+        string engine = "dijkstra");
 
-    // get nodes with a range for a specific list of source nodes
-    vector<vector<pair<long, float>>> Range(vector<long> srcnodes, float radius, 
-                                            int graphno, vector<long> ext_ids);
+    // computes the accessibility for the source nodes only - the result
+    // has one score per source node, in the same order
+    vector<double>
+    getAggregateAccessibilityVariables(
+        vector<long> srcnodes,
+        float radius,
+        string index,
+        string aggtyp,
+        string decay,
+        int graphno = 0,
+        string engine = "dijkstra");
+
+    // computes the accessibility for the source nodes only at several radii
+    // from a single range query per source - the result has one row of
+    // scores per radius, one per source node in the same order, and is
+    // empty if the aggregation can't be computed
+    vector<double>
+    getAggregateAccessibilityVariables(
+        vector<long> srcnodes,
+        vector<float> radii,
+        string index,
+        string aggtyp,
+        string decay,
+        int graphno = 0,
+        string engine = "dijkstra");
+
+    // computes the accessibility for every node in the network at several
+    // radii from a single range query per node - the result has one row
+    // of numnodes scores per radius, one after the other, and is empty if
+    // the aggregation can't be computed
+    vector<double>
+    getAllAggregateAccessibilityVariables(
+        vector<float> radii,
+        string index,
+        string aggtyp,
+        string decay,
+        int graphno = 0,
+        string engine = "dijkstra");
+
+    // computes several aggregations for every node in the network - the
+    // i-th aggregation is given by categories[i], aggtyps[i] and decays[i],
+    // and all of them share a single range query per source node.  The
+    // result has one row of numnodes scores per aggregation, one after the
+    // other, and an invalid aggregation gets a row of nans
+    vector<double>
+    getManyAggregateAccessibilityVariables(
+        float radius,
+        vector<string> categories,
+        vector<string> aggtyps,
+        vector<string> decays,
+        int graphno = 0,
+        string engine = "dijkstra");
+
+    // get nodes with a range for a specific list of source nodes - the
+    // nodes (as ext_ids) and distances of source i are nodes[offsets[i]]
+    // to nodes[offsets[i+1]-1] and the same entries of distances, and
+    // offsets is empty if the engine is unknown
+    void Range(vector<long> srcnodes, float radius, int graphno,
+               vector<long> ext_ids, string engine, vector<long> &offsets,
+               vector<long> &nodes, vector<float> &distances);
 
     // shortest path between two points
     vector<int> Route(int src, int tgt, int graphno = 0);
 
-    // shortest path between list of origins and destinations
-    vector<vector<int>> Routes(vector<long> sources, vector<long> targets,  
-                               int graphno = 0);
+    // shortest path between list of origins and destinations - the nodes
+    // of path i are nodes[offsets[i]] to nodes[offsets[i+1]-1]
+    void Routes(vector<long> sources, vector<long> targets, int graphno,
+                vector<long> &offsets, vector<long> &nodes);
 
     // shortest path distance between two points
     double Distance(int src, int tgt, int graphno = 0);
@@ -63,8 +153,65 @@ class Accessibility {
     vector<double> Distances(vector<long> sources, vector<long> targets,  
                              int graphno = 0);
 
+    // shortest path distances between every origin and every destination,
+    // written row by row to matrix which must have room for
+    // sources.size() * targets.size() values - this runs a single search
+    // per origin and destination rather than one per pair
+    void DistanceMatrix(vector<long> sources, vector<long> targets,
+                        float *matrix, int graphno = 0);
+
+    // write the distances between every origin and every destination to a
+    // skim file, for matrices too large to hold in memory - the matrix is
+    // computed tileSize by tileSize tiles at a time, in parallel, and each
+    // tile is compressed and written as soon as its batch is done.  the
+    // tiles held in memory at once are capped so that they and the buckets
+    // of the destinations fit in memoryBudget megabytes.  if filename holds
+    // part of the same skim already only the missing tiles are computed.
+    // throws std::runtime_error if the file can't be written
+    void writeSkim(vector<long> sources, vector<long> targets,
+                   string filename, int tileSize = 1024,
+                   double memoryBudget = 1024, int graphno = 0);
+
+    // set up the target set name with targets at the node_idx locations,
+    // so that distances to all of them can be found quickly from any
+    // number of sources - this extracts the part of the contracted graph
+    // above the targets once, for RPHAST queries
+    void initializeTargetSet(string name, vector<long> node_idx);
+
+    // shortest path distances from each source node to every target of
+    // the set name - the result has one row per source node, one after
+    // the other, with the targets in the order they were given - it is
+    // empty if there is no such target set
+    vector<double>
+    getDistancesToTargets(vector<long> srcnodes, string name,
+                          int graphno = 0);
+
     // precompute the range queries and reuse them
-    void precomputeRangeQueries(float radius);
+    void precomputeRangeQueries(float radius, string engine = "dijkstra");
+
+    // write the precomputed range queries to a file, or map a file written
+    // earlier for this network back in - these throw std::runtime_error if
+    // the file can't be used
+    void saveRangeQueries(std::string filename);
+    void loadRangeQueries(std::string filename);
+
+    // give the edges edge_ids (positions in the edges of the constructor)
+    // of graph graphno new weights - the contraction hierarchies of the
+    // graph are customized again for them rather than rebuilt, the POIs
+    // and target sets are kept, and the precomputed range queries are
+    // dropped.  throws std::runtime_error if the arguments don't fit the
+    // network
+    void updateEdgeWeights(vector<long> edge_ids, vector<double> weights,
+                           int graphno = 0);
+
+    // the bytes taken by each part of graph graphno which isn't shared with
+    // the other graphs, or by each of the shared parts if graphno is -1
+    std::map<std::string, size_t> memoryUsage(int graphno);
+
+    // write the contraction hierarchies of the graphs to a file, which can
+    // be passed as chFile to the constructor of the same network to skip
+    // the preprocessing - throws std::runtime_error if it can't be written
+    void saveContractionHierarchies(std::string filename);
 
     // aggregation types
     vector<string> aggregations;
@@ -72,20 +219,51 @@ class Accessibility {
     // decay types
     vector<string> decays;
 
+    // range query engines
+    vector<string> engines;
+
  private:
     double maxdist;
     int maxitems;
 
+    // the file the contraction hierarchies of the graphs were loaded from,
+    // if any - it is declared first so that it outlives the graphs
+    std::shared_ptr<CHFile> chfile;
+
     // a vector of graphs - all these graphs share the same nodes, and
     // thus it shares the same accessibility_vars_t as well -
     // this is used e.g. for road networks where we have congestion
     // by time of day
     vector<std::shared_ptr<Graphalg> > ga;
 
-    // accessibility_vars_t is a vector of floating point values
-    // assigned to each node - the first level of the data structure
-    // is dereferenced by node index
-    typedef vector<vector<float> > accessibility_vars_t;
+    // the edges of the graphs without their weights, which they share
+    std::shared_ptr<const CH::EdgeTopology> topology;
+
+    // the customizable hierarchy shared by the graphs - it is built when
+    // the edge weights of a graph are first updated if the network was
+    // made with another hierarchy
+    std::shared_ptr<const CH::CCHTopology> cch;
+
+    // accessibility_vars_t holds the floating point values assigned to
+    // each node, along with their per node stats
+    typedef AccessibilityVars accessibility_vars_t;
+
+    // an aggregation over the nodes of a range query, specialized for one
+    // aggregation type and decay
+    typedef double (*AggregationKernel)(
+        const RangeResult &range,
+        float radius,
+        const accessibility_vars_t &vars,
+        QuantileScratch &scratch);
+
+    // an aggregation for every node which searches backwards from each node
+    // having the variable and pushes its items to the sources reaching it,
+    // specialized for one aggregation type and decay
+    typedef void (*ScatterKernel)(
+        Graphalg &g,
+        float radius,
+        const accessibility_vars_t &vars,
+        vector<double> &scores);
     map<string, accessibility_vars_t> accessibilityVars;
     // this is a map for pois so we can keep track of how many
     // pois there are at each node - for now all the values are
@@ -96,34 +274,76 @@ class Accessibility {
 
     // this stores the nodes within a certain range - we have the option
     // of precomputing all the nodes in a radius if we're going to make
-    // lots of aggregation queries on the same network
+    // lots of aggregation queries on the same network - there is one
+    // cache per graph
     float dmsradius;
-    vector<vector<DistanceVec> > dms;
+    vector<RangeCache> dms;
 
     int numnodes;
 
     void addGraphalg(MTC::accessibility::Graphalg *g);
 
+    // the nodes within radius of srcnode - this refers to the precomputed
+    // results if they cover radius and otherwise to a search stored in tmp
+    RangeResult
+    nodesInRange(int srcnode, float radius, int graphno, RangeBuffer &tmp);
+
+    // the kernel which computes aggtyp with decay, or NULL if either of
+    // them is unknown - strings are resolved once per call rather than
+    // once per node
+    AggregationKernel findAggregationKernel(string aggtyp, string decay);
+
+    // as above, but NULL for the quantiles which can't be pushed
+    ScatterKernel findScatterKernel(string aggtyp, string decay);
+
+    // the positions of aggtyp and decay in aggregations and decays
+    bool findAggregationType(string aggtyp, string decay, int &a, int &d);
+
+    bool findRangeEngine(string engine, RangeEngine &e);
+
+    // the first n pairs of a paired query grouped by their source - the
+    // pairs of group g are order[groupStart[g]] to order[groupStart[g+1]-1],
+    // in their original order
+    static void groupBySource(const vector<long> &sources, int n,
+                              vector<int> &order, vector<int> &groupStart);
+
+    // calls visit(i, range, scratch) in parallel with the range query from
+    // srcnodes[i] for every i < n, or from node i if srcnodes is NULL -
+    // scratch is the calling thread's
+    template <class Visit>
+    void forEachRange(int n, const long *srcnodes, float radius,
+                      int graphno, RangeEngine engine, Visit visit);
+
     vector<pair<double, int>>
     findNearestPOIs(int srcnode, float maxradius, unsigned maxnumber,
                     string cat, int graphno = 0);
 
-    // aggregate a variable within a radius
-    double
+    // aggregate a variable over the nodes of an existing range query
+    template <AggregationType A, DecayType D>
+    static double
     aggregateAccessibilityVariable(
-        int srcnode,
+        const RangeResult &range,
         float radius,
-        accessibility_vars_t &vars,
-        string aggtyp,
-        string gravity_func,
-        int graphno = 0);
+        const accessibility_vars_t &vars,
+        QuantileScratch &scratch);
+
+    template <AggregationType A, DecayType D>
+    static void
+    scatterAccessibilityVariable(
+        Graphalg &g,
+        float radius,
+        const accessibility_vars_t &vars,
+        vector<double> &scores);
 
-    double
+    // a quantile of the items within radius, the range query being
+    // already cut at radius - this is exact unless the variable has a
+    // quantile sketch
+    static double
     quantileAccessibilityVariable(
-        DistanceVec &distances,
-        accessibility_vars_t &vars,
+        const RangeResult &range,
+        const accessibility_vars_t &vars,
         float quantile,
-        float radius);
+        QuantileScratch &scratch);
 };
 }  // namespace accessibility
 }  // namespace MTC
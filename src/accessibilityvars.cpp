@@ -0,0 +1,82 @@
+#include "accessibilityvars.h"
+#include <algorithm>
+#include <cassert>
+
+namespace MTC {
+namespace accessibility {
+
+AccessibilityVars::AccessibilityVars(int numnodes,
+                                     const vector<long> &node_idx,
+                                     const vector<double> &values,
+                                     int quantileBins)
+    : quantileBins(0), binMin(0), binWidth(0) {
+    nodeStats.assign(numnodes, emptyNodeStats());
+
+    // count the values at each node so the offsets can be laid out, then
+    // drop every value into the next free slot of its node
+    offsets.assign(numnodes + 1, 0);
+    for (int i = 0 ; i < node_idx.size() ; i++) {
+        assert(node_idx[i] < numnodes);
+        offsets[node_idx[i] + 1]++;
+    }
+    for (int i = 0 ; i < numnodes ; i++) {
+        offsets[i+1] += offsets[i];
+    }
+
+    this->values.resize(node_idx.size());
+    for (int i = 0 ; i < node_idx.size() ; i++) {
+        int node = node_idx[i];
+        float val = values[i];
+        NodeStats &s = nodeStats[node];
+
+        this->values[offsets[node] + s.count] = val;
+        s.count++;
+        s.sum += val;
+        s.sumsq += val * val;
+        if (val < s.min) s.min = val;
+        if (val > s.max) s.max = val;
+    }
+
+    for (int i = 0 ; i < numnodes ; i++) {
+        if (nodeStats[i].count > 0) occupied.push_back(i);
+    }
+
+    if (quantileBins > 0 && !values.empty()) {
+        this->quantileBins = quantileBins;
+        buildSketch(numnodes);
+    }
+}
+
+
+void AccessibilityVars::buildSketch(int numnodes) {
+    binMin = *std::min_element(values.begin(), values.end());
+    float binMax = *std::max_element(values.begin(), values.end());
+    binWidth = (binMax - binMin) / quantileBins;
+
+    binOffsets.assign(numnodes + 1, 0);
+    binCounts.clear();
+
+    vector<float> sorted;
+    for (int node = 0 ; node < numnodes ; node++) {
+        // the values of the node in order fall into ascending runs of bins
+        sorted.assign(begin(node), end(node));
+        std::sort(sorted.begin(), sorted.end());
+        for (int i = 0 ; i < sorted.size() ; i++) {
+            int bin = 0;
+            if (binWidth > 0) {
+                bin = std::min(quantileBins - 1, static_cast<int>(
+                    (sorted[i] - binMin) / binWidth));
+            }
+            if (binCounts.size() > binOffsets[node] &&
+                binCounts.back().bin == bin) {
+                binCounts.back().count++;
+            } else {
+                BinCount bc = {bin, 1};
+                binCounts.push_back(bc);
+            }
+        }
+        binOffsets[node+1] = binCounts.size();
+    }
+}
+}  // namespace accessibility
+}  // namespace MTC
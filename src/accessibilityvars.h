@@ -0,0 +1,99 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+#include "shared.h"
+
+namespace MTC {
+namespace accessibility {
+
+using std::vector;
+
+// the items at a single node reduced to what the aggregations which don't
+// need the individual values use
+struct NodeStats {
+    int count;
+    float min;
+    float max;
+    double sum;
+    double sumsq;
+};
+
+// the stats of no items at all
+inline NodeStats emptyNodeStats() {
+    NodeStats s = {0, std::numeric_limits<float>::infinity(),
+                   -std::numeric_limits<float>::infinity(), 0.0, 0.0};
+    return s;
+}
+
+// the number of values at a node which fall in one of the bins of a
+// quantile sketch
+struct BinCount {
+    int bin;
+    int count;
+};
+
+// per thread scratch space for the quantile aggregations, so that they
+// don't allocate for every source node
+struct QuantileScratch {
+    vector<float> values;
+    vector<int> binCounts;
+};
+
+// floating point values assigned to the nodes of a network, stored in
+// compressed sparse row format - the values at node i are
+// values[offsets[i]] to values[offsets[i+1]-1] in the order they were
+// given - along with the stats of each node.
+//
+// optionally the values are also counted into quantileBins bins of equal
+// width spanning all the values, giving a sketch of each node from which
+// quantiles can be approximated without visiting the values - the
+// approximation returns the midpoint of the bin which holds the exact
+// quantile, so it is off by at most half of binWidth
+class AccessibilityVars {
+ public:
+    AccessibilityVars() : quantileBins(0), binMin(0), binWidth(0) {}
+
+    // node_idx[i] is the node which values[i] is at
+    AccessibilityVars(int numnodes, const vector<long> &node_idx,
+                      const vector<double> &values, int quantileBins = 0);
+
+    int count(int node) const { return offsets[node+1] - offsets[node]; }
+    const float *begin(int node) const {
+        return values.data() + offsets[node];
+    }
+    const float *end(int node) const {
+        return values.data() + offsets[node+1];
+    }
+    const NodeStats &stats(int node) const { return nodeStats[node]; }
+
+    // the nodes which have any values, in ascending order
+    const vector<int> &occupiedNodes() const { return occupied; }
+
+    // the quantile sketch, if there is one - only the bins of a node which
+    // hold any values are stored
+    bool sketched() const { return quantileBins > 0; }
+    const BinCount *binsBegin(int node) const {
+        return binCounts.data() + binOffsets[node];
+    }
+    const BinCount *binsEnd(int node) const {
+        return binCounts.data() + binOffsets[node+1];
+    }
+
+    int quantileBins;
+    float binMin;
+    float binWidth;
+
+ private:
+    vector<int> offsets;
+    vector<float> values;
+    vector<NodeStats> nodeStats;
+    vector<int> occupied;
+
+    vector<int> binOffsets;
+    vector<BinCount> binCounts;
+
+    void buildSketch(int numnodes);
+};
+}  // namespace accessibility
+}  // namespace MTC
@@ -0,0 +1,148 @@
+#include "chfile.h"
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace MTC {
+namespace accessibility {
+
+// the layout of a saved file is the header, then a CHFileGraph for each
+// graph, then the data of each graph in turn, padded to a multiple of 8
+// bytes so that the arrays in it are aligned when the file is mapped.  the
+// graphs are used as they were written, so the sizes of the node and edge
+// records of the build that wrote them are kept to check them against
+#define CH_FILE_MAGIC "PNDCHGR"
+#define CH_FILE_VERSION 3
+
+struct CHFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numgraphs;
+    uint64_t numnodes;
+    uint32_t noderecordsize;
+    uint32_t edgerecordsize;
+};
+
+struct CHFileGraph {
+    uint64_t fingerprint;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+
+static uint64_t padded(uint64_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+
+static uint64_t checksum(const char *data, uint64_t size) {
+    uint64_t hash = FNV_OFFSET;
+    hashBytes(hash, data, size);
+    return hash;
+}
+
+
+void CHFile::save(const std::string &filename,
+                  const vector<std::shared_ptr<Graphalg> > &graphs,
+                  int numnodes) {
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Unable to open " + filename +
+                                 " for writing");
+    }
+
+    vector<std::string> data(graphs.size());
+    for (int i = 0 ; i < graphs.size() ; i++) {
+        std::ostringstream buf;
+        graphs[i]->ch.WriteGraphs(buf);
+        data[i] = buf.str();
+    }
+
+    CHFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CH_FILE_MAGIC, sizeof(header.magic));
+    header.version = CH_FILE_VERSION;
+    header.numgraphs = graphs.size();
+    header.numnodes = numnodes;
+    header.noderecordsize = QueryGraph::NodeRecordSize();
+    header.edgerecordsize = QueryGraph::EdgeRecordSize();
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (int i = 0 ; i < graphs.size() ; i++) {
+        CHFileGraph graph = {graphs[i]->fingerprint, data[i].size(),
+                             checksum(data[i].data(), data[i].size())};
+        out.write(reinterpret_cast<const char *>(&graph), sizeof(graph));
+    }
+
+    static const char zeros[8] = {0};
+    for (int i = 0 ; i < graphs.size() ; i++) {
+        out.write(data[i].data(), data[i].size());
+        out.write(zeros, padded(data[i].size()) - data[i].size());
+    }
+
+    if (!out) {
+        throw std::runtime_error("error writing " + filename);
+    }
+}
+
+
+CHFile::CHFile(const std::string &filename,
+               const vector<uint64_t> &fingerprints, int numnodes)
+    : file(new MappedFile(filename, true)) {
+    const char *data = file->data();
+    uint64_t size = file->size();
+
+    CHFileHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error(filename +
+                                 " is not a contraction hierarchy file");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CH_FILE_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(filename +
+                                 " is not a contraction hierarchy file");
+    }
+    if (header.version != CH_FILE_VERSION) {
+        throw std::runtime_error(filename +
+                                 " was written by an unsupported version");
+    }
+    if (header.noderecordsize != QueryGraph::NodeRecordSize() ||
+        header.edgerecordsize != QueryGraph::EdgeRecordSize()) {
+        throw std::runtime_error(filename +
+                                 " was written by an incompatible build");
+    }
+    if (header.numnodes != numnodes ||
+        header.numgraphs != fingerprints.size()) {
+        throw std::runtime_error(filename +
+                                 " was computed on a different network");
+    }
+
+    uint64_t pos = sizeof(header) + header.numgraphs * sizeof(CHFileGraph);
+    if (size < pos) {
+        throw std::runtime_error(filename + " is truncated");
+    }
+
+    for (int i = 0 ; i < header.numgraphs ; i++) {
+        CHFileGraph graph;
+        memcpy(&graph, data + sizeof(header) + i * sizeof(graph),
+               sizeof(graph));
+        if (graph.fingerprint != fingerprints[i]) {
+            throw std::runtime_error(filename +
+                                     " was computed on a different network");
+        }
+        if (size < pos + padded(graph.size)) {
+            throw std::runtime_error(filename + " is truncated");
+        }
+        if (checksum(data + pos, graph.size) != graph.checksum ||
+            !CH::ContractionHierarchies::CheckGraphs(data + pos, graph.size,
+                                                     numnodes)) {
+            throw std::runtime_error(filename + " is corrupt");
+        }
+        offsets.push_back(pos);
+        sizes.push_back(graph.size);
+        pos += padded(graph.size);
+    }
+}
+}  // namespace accessibility
+}  // namespace MTC
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shared.h"
+#include "graphalg.h"
+#include "mappedfile.h"
+
+namespace MTC {
+namespace accessibility {
+
+using std::vector;
+
+// the contraction hierarchies of all the graphs of a network, saved to a
+// file so that they needn't be rebuilt in every session.  each graph is
+// stored as written by CH::ContractionHierarchies::WriteGraphs, along with
+// the fingerprint of the edges it was built from and a checksum, and
+// loading maps the file copy-on-write so the graphs are used in place -
+// processes loading the same file share it through the page cache
+class CHFile {
+ public:
+    // write the hierarchies of graphs to filename
+    static void save(const std::string &filename,
+                     const vector<std::shared_ptr<Graphalg> > &graphs,
+                     int numnodes);
+
+    // map a file written by save, throwing std::runtime_error if it isn't
+    // one or isn't for graphs with these fingerprints
+    CHFile(const std::string &filename, const vector<uint64_t> &fingerprints,
+           int numnodes);
+
+    // the saved hierarchies of graph i, for the Graphalg constructor
+    char *graph(int i) { return file->mutableData() + offsets[i]; }
+    size_t graphSize(int i) const { return sizes[i]; }
+
+ private:
+    std::shared_ptr<MappedFile> file;
+    vector<uint64_t> offsets;
+    vector<uint64_t> sizes;
+};
+}  // namespace accessibility
+}  // namespace MTC
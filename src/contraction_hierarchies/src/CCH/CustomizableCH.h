@@ -0,0 +1,664 @@
+#ifndef CUSTOMIZABLECH_H_INCLUDED
+#define CUSTOMIZABLECH_H_INCLUDED
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "../BasicDefinitions.h"
+
+//Cells of the nested dissection with at most this many nodes are not split further
+#define CCH_MIN_CELL 16
+
+namespace CH {
+    /*
+     Customizable contraction hierarchies (Dibbelt, Strasser and Wagner 2014). The
+     order of the nodes and the shortcuts only depend on the topology of the graph,
+     so they are computed once and shared by all its metrics. The order is a nested
+     dissection: a separator splitting the graph in two gets the top ranks, and the
+     two halves are ordered the same way below it. The shortcuts are then those of
+     contracting the nodes in that order without looking at any weights, i.e. the
+     upper neighbours of every node form a clique (the chordal completion). The
+     arcs are stored by their lower end, in rank space, and the input edges along
+     each are kept so that a metric can be updated for some of them.
+     */
+    class CCHTopology {
+        friend class CCHMetric;
+
+    public:
+        //edges is a vector of edges, or anything indexed like one
+        template<typename EdgesT>
+        CCHTopology(unsigned numberOfNodes, const EdgesT & edges) : numberOfNodes(numberOfNodes) {
+            std::vector<std::vector<NodeID> > neighbours(numberOfNodes);
+            for(unsigned i = 0; i < edges.size(); ++i) {
+                const NodeID s = edges[i].source(), t = edges[i].target();
+                if(s == t)
+                    continue;
+                neighbours[s].push_back(t);
+                neighbours[t].push_back(s);
+            }
+            _Order(neighbours);
+
+            //Contract the nodes in order - the upper neighbours of a node become
+            //upper neighbours of the lowest of them
+            std::vector<std::vector<unsigned> > upper(numberOfNodes);
+            for(NodeID node = 0; node < numberOfNodes; ++node) {
+                for(unsigned i = 0; i < neighbours[node].size(); ++i) {
+                    const unsigned other = rank[neighbours[node][i]];
+                    if(rank[node] < other)
+                        upper[rank[node]].push_back(other);
+                }
+                std::vector<NodeID>().swap(neighbours[node]);
+            }
+            for(unsigned r = 0; r < numberOfNodes; ++r) {
+                std::sort(upper[r].begin(), upper[r].end());
+                upper[r].erase(std::unique(upper[r].begin(), upper[r].end()), upper[r].end());
+                if(upper[r].size() > 1) {
+                    std::vector<unsigned> & parent = upper[upper[r][0]];
+                    parent.insert(parent.end(), upper[r].begin() + 1, upper[r].end());
+                }
+            }
+
+            firstArc.assign(numberOfNodes + 1, 0);
+            for(unsigned r = 0; r < numberOfNodes; ++r)
+                firstArc[r+1] = firstArc[r] + upper[r].size();
+            arcHead.reserve(firstArc[numberOfNodes]);
+            arcTail.reserve(firstArc[numberOfNodes]);
+            for(unsigned r = 0; r < numberOfNodes; ++r) {
+                arcHead.insert(arcHead.end(), upper[r].begin(), upper[r].end());
+                arcTail.insert(arcTail.end(), upper[r].size(), r);
+                std::vector<unsigned>().swap(upper[r]);
+            }
+
+            //The arc of every input edge, and the input edges of every arc
+            inputArc.resize(edges.size());
+            firstInput.assign(arcHead.size() + 1, 0);
+            for(unsigned i = 0; i < edges.size(); ++i) {
+                const unsigned s = rank[edges[i].source()], t = rank[edges[i].target()];
+                inputArc[i] = s == t ? SPECIAL_EDGEID : FindArc(std::min(s, t), std::max(s, t));
+                if(inputArc[i] != SPECIAL_EDGEID)
+                    ++firstInput[inputArc[i] + 1];
+            }
+            for(unsigned a = 0; a < arcHead.size(); ++a)
+                firstInput[a+1] += firstInput[a];
+            arcInputs.resize(firstInput.back());
+            std::vector<unsigned> fillInput(firstInput.begin(), firstInput.end() - 1);
+            for(unsigned i = 0; i < edges.size(); ++i) {
+                if(inputArc[i] != SPECIAL_EDGEID)
+                    arcInputs[fillInput[inputArc[i]]++] = i;
+            }
+
+            //The lower neighbours of every node with the arcs to them, sorted by rank
+            firstLowerArc.assign(numberOfNodes + 1, 0);
+            for(unsigned a = 0; a < arcHead.size(); ++a)
+                ++firstLowerArc[arcHead[a] + 1];
+            for(unsigned r = 0; r < numberOfNodes; ++r)
+                firstLowerArc[r+1] += firstLowerArc[r];
+            lowerArcs.resize(arcHead.size());
+            std::vector<unsigned> fill(firstLowerArc.begin(), firstLowerArc.end() - 1);
+            for(unsigned r = 0; r < numberOfNodes; ++r) {
+                for(unsigned a = firstArc[r]; a < firstArc[r+1]; ++a)
+                    lowerArcs[fill[arcHead[a]]++] = std::make_pair(r, a);
+            }
+
+            //The arcs of a node only depend on those of its lower neighbours, which
+            //are all on lower levels, so each level can be customized in parallel
+            std::vector<unsigned> level(numberOfNodes, 0);
+            unsigned numberOfLevels = numberOfNodes ? 1 : 0;
+            for(unsigned r = 0; r < numberOfNodes; ++r) {
+                for(unsigned a = firstArc[r]; a < firstArc[r+1]; ++a)
+                    level[arcHead[a]] = std::max(level[arcHead[a]], level[r] + 1);
+                numberOfLevels = std::max(numberOfLevels, level[r] + 1);
+            }
+            firstOnLevel.assign(numberOfLevels + 1, 0);
+            for(unsigned r = 0; r < numberOfNodes; ++r)
+                ++firstOnLevel[level[r] + 1];
+            for(unsigned l = 0; l < numberOfLevels; ++l)
+                firstOnLevel[l+1] += firstOnLevel[l];
+            byLevel.resize(numberOfNodes);
+            fill.assign(firstOnLevel.begin(), firstOnLevel.end() - 1);
+            for(unsigned r = 0; r < numberOfNodes; ++r)
+                byLevel[fill[level[r]]++] = r;
+        }
+
+        unsigned GetNumberOfNodes() const { return numberOfNodes; }
+        unsigned GetNumberOfArcs() const { return arcHead.size(); }
+
+        size_t MemoryUsage() const {
+            return (order.capacity() + rank.capacity() + firstArc.capacity() + arcHead.capacity() + arcTail.capacity() +
+                    inputArc.capacity() + firstInput.capacity() + arcInputs.capacity() + firstLowerArc.capacity() +
+                    2 * lowerArcs.capacity() + firstOnLevel.capacity() + byLevel.capacity()) * sizeof(unsigned);
+        }
+
+        //The arc between the nodes of ranks lower < upper, SPECIAL_EDGEID if there is none
+        unsigned FindArc(const unsigned lower, const unsigned upper) const {
+            const std::vector<unsigned>::const_iterator begin = arcHead.begin() + firstArc[lower];
+            const std::vector<unsigned>::const_iterator end = arcHead.begin() + firstArc[lower+1];
+            const std::vector<unsigned>::const_iterator it = std::lower_bound(begin, end, upper);
+            return (it != end && *it == upper) ? unsigned(it - arcHead.begin()) : SPECIAL_EDGEID;
+        }
+
+    private:
+        /*
+         Nested dissection by breadth first search: a cell is searched from a node
+         as far from the rest as can easily be found, and one of the levels of the
+         search around its middle is a separator, since the search only has edges
+         within a level or between neighbouring ones. The smallest level that leaves
+         no more than two thirds of the cell on either side is used.
+         */
+        void _Order(const std::vector<std::vector<NodeID> > & neighbours) {
+            std::vector<unsigned> cellOf(numberOfNodes, 1);
+            std::vector<unsigned> distance(numberOfNodes);
+            std::vector<unsigned> seen(numberOfNodes, 0);
+            unsigned search = 0, nextCell = 2;
+            std::vector<NodeID> reverseOrder, queue;
+            reverseOrder.reserve(numberOfNodes);
+
+            std::vector<std::vector<NodeID> > cells(1);
+            for(NodeID node = 0; node < numberOfNodes; ++node)
+                cells[0].push_back(node);
+
+            while(!cells.empty()) {
+                std::vector<NodeID> cell;
+                cell.swap(cells.back());
+                cells.pop_back();
+                if(cell.size() <= CCH_MIN_CELL) {
+                    reverseOrder.insert(reverseOrder.end(), cell.begin(), cell.end());
+                    continue;
+                }
+                const unsigned id = cellOf[cell[0]];
+
+                _Search(neighbours, cell[0], id, cellOf, ++search, seen, distance, queue);
+                if(queue.size() < cell.size()) {
+                    //Not connected - every component is a cell of its own, without a separator.
+                    //They are all found in one pass over the cell, as the nodes of the cell
+                    //not found yet are searched from under the same search number
+                    _NewCell(queue, nextCell++, cellOf, cells);
+                    for(unsigned i = 0; i < cell.size(); ++i) {
+                        if(seen[cell[i]] == search)
+                            continue;
+                        _Search(neighbours, cell[i], id, cellOf, search, seen, distance, queue);
+                        _NewCell(queue, nextCell++, cellOf, cells);
+                    }
+                    continue;
+                }
+
+                _Search(neighbours, queue.back(), id, cellOf, ++search, seen, distance, queue);
+                const unsigned numberOfLevels = distance[queue.back()] + 1;
+                if(numberOfLevels < 3) {
+                    reverseOrder.insert(reverseOrder.end(), cell.begin(), cell.end());
+                    continue;
+                }
+                std::vector<unsigned> firstOf(numberOfLevels + 1, 0);
+                for(unsigned i = 0; i < queue.size(); ++i)
+                    ++firstOf[distance[queue[i]] + 1];
+                for(unsigned l = 0; l < numberOfLevels; ++l)
+                    firstOf[l+1] += firstOf[l];
+
+                unsigned separator = 0;
+                for(unsigned l = 1; l + 1 < numberOfLevels; ++l) {
+                    const bool balanced = 3 * firstOf[l] <= 2 * cell.size() && 3 * (cell.size() - firstOf[l+1]) <= 2 * cell.size();
+                    if(balanced && (separator == 0 || firstOf[l+1] - firstOf[l] < firstOf[separator+1] - firstOf[separator]))
+                        separator = l;
+                }
+                if(separator == 0) {
+                    separator = 1;
+                    while(separator + 2 < numberOfLevels && 2 * firstOf[separator+1] < cell.size())
+                        ++separator;
+                }
+
+                for(unsigned i = firstOf[separator]; i < firstOf[separator+1]; ++i) {
+                    reverseOrder.push_back(queue[i]);
+                    cellOf[queue[i]] = 0;
+                }
+                _NewCell(std::vector<NodeID>(queue.begin(), queue.begin() + firstOf[separator]), nextCell++, cellOf, cells);
+                _NewCell(std::vector<NodeID>(queue.begin() + firstOf[separator+1], queue.end()), nextCell++, cellOf, cells);
+            }
+
+            order.assign(reverseOrder.rbegin(), reverseOrder.rend());
+            rank.resize(numberOfNodes);
+            for(unsigned r = 0; r < numberOfNodes; ++r)
+                rank[order[r]] = r;
+        }
+
+        //Breadth first search from source within its cell, leaving the nodes found in queue in the order found
+        static void _Search(const std::vector<std::vector<NodeID> > & neighbours, const NodeID source, const unsigned cell,
+                            const std::vector<unsigned> & cellOf, const unsigned search, std::vector<unsigned> & seen,
+                            std::vector<unsigned> & distance, std::vector<NodeID> & queue) {
+            queue.clear();
+            queue.push_back(source);
+            seen[source] = search;
+            distance[source] = 0;
+            for(unsigned i = 0; i < queue.size(); ++i) {
+                const NodeID node = queue[i];
+                for(unsigned j = 0; j < neighbours[node].size(); ++j) {
+                    const NodeID to = neighbours[node][j];
+                    if(cellOf[to] != cell || seen[to] == search)
+                        continue;
+                    seen[to] = search;
+                    distance[to] = distance[node] + 1;
+                    queue.push_back(to);
+                }
+            }
+        }
+
+        static void _NewCell(const std::vector<NodeID> & nodes, const unsigned id, std::vector<unsigned> & cellOf,
+                             std::vector<std::vector<NodeID> > & cells) {
+            if(nodes.empty())
+                return;
+            for(unsigned i = 0; i < nodes.size(); ++i)
+                cellOf[nodes[i]] = id;
+            cells.push_back(nodes);
+        }
+
+        unsigned numberOfNodes;
+        std::vector<NodeID> order;
+        std::vector<unsigned> rank;
+        //The arcs up from rank r are firstArc[r] to firstArc[r+1]-1, arcHead being the upper ends
+        std::vector<unsigned> firstArc;
+        std::vector<unsigned> arcHead;
+        std::vector<unsigned> arcTail;
+        //The arc of each input edge, SPECIAL_EDGEID for loops, and the input edges
+        //along arc a, arcInputs[firstInput[a]] to arcInputs[firstInput[a+1]-1]
+        std::vector<unsigned> inputArc;
+        std::vector<unsigned> firstInput;
+        std::vector<unsigned> arcInputs;
+        //The (lower end, arc) pairs of the arcs down from rank r, from firstLowerArc[r]
+        std::vector<unsigned> firstLowerArc;
+        std::vector<std::pair<unsigned, unsigned> > lowerArcs;
+        //The ranks of the nodes by level, those on level l from firstOnLevel[l]
+        std::vector<unsigned> firstOnLevel;
+        std::vector<unsigned> byLevel;
+    };
+
+    /*
+     The weights of the arcs of a CCHTopology for one metric. Customization visits
+     the arcs bottom up and sets the weight of each arc (v,u) in either direction to
+     the smallest of the input edges along it and the paths v-w-u over the lower
+     triangles, i.e. the nodes w below both which have arcs to both. Afterwards the
+     upward arcs with their weights are a contraction hierarchy for the metric, and
+     the middle nodes of the triangles used let the shortcuts be unpacked.
+     */
+    class CCHMetric {
+    public:
+        CCHMetric() : customized(false) {}
+
+        //edges must be those the topology was built from
+        template<typename EdgesT>
+        CCHMetric(std::shared_ptr<const CCHTopology> _topology, const EdgesT & edges) :
+            topology(_topology), customized(false) {
+            CHASSERT(edges.size() == topology->inputArc.size(), "Edges differ from those of the topology");
+            const unsigned numberOfArcs = topology->GetNumberOfArcs();
+            inputUp.resize(numberOfArcs);
+            inputDown.resize(numberOfArcs);
+            for(unsigned a = 0; a < numberOfArcs; ++a)
+                _SetInputWeights(a, edges);
+        }
+
+        bool Customized() const { return customized; }
+
+        size_t MemoryUsage() const {
+            return (inputUp.capacity() + inputDown.capacity() + up.capacity() + down.capacity() + upMiddle.capacity() +
+                    downMiddle.capacity() + exactUp.capacity() + exactDown.capacity()) * sizeof(unsigned) + queued.capacity() / 8;
+        }
+
+        void Customize() {
+            const unsigned numberOfArcs = topology->GetNumberOfArcs();
+            up.resize(numberOfArcs);
+            down.resize(numberOfArcs);
+            upMiddle.resize(numberOfArcs);
+            downMiddle.resize(numberOfArcs);
+            exactUp.resize(numberOfArcs);
+            exactDown.resize(numberOfArcs);
+            const std::vector<unsigned> & firstOnLevel = topology->firstOnLevel;
+            const int numberOfLevels = int(firstOnLevel.size()) - 1;
+            for(int l = 0; l < numberOfLevels; ++l) {
+                const int begin = firstOnLevel[l], end = firstOnLevel[l+1];
+#pragma omp parallel for schedule ( dynamic, 64 ) if ( end - begin > 256 )
+                for(int i = begin; i < end; ++i) {
+                    const unsigned r = topology->byLevel[i];
+                    for(unsigned a = topology->firstArc[r]; a < topology->firstArc[r+1]; ++a)
+                        _CustomizeArc(r, a);
+                }
+            }
+            for(int l = numberOfLevels - 1; l >= 0; --l) {
+                const int begin = firstOnLevel[l], end = firstOnLevel[l+1];
+#pragma omp parallel for schedule ( dynamic, 64 ) if ( end - begin > 256 )
+                for(int i = begin; i < end; ++i) {
+                    const unsigned r = topology->byLevel[i];
+                    for(unsigned a = topology->firstArc[r]; a < topology->firstArc[r+1]; ++a)
+                        _ExactArc(r, a);
+                }
+            }
+            queued.assign(topology->GetNumberOfArcs(), false);
+            customized = true;
+        }
+
+        /*
+         Customize again after the weights of the edges edgeIDs have changed. Only
+         the arcs whose weights can depend on them are done: bottom up, an arc (w,x)
+         whose weight changes is in the lower triangle w of the arc between x and
+         every other upper neighbour y of w, and top down, the exact weights of all
+         the arcs from a node whose weights changed are done again, as is any arc
+         (w,x) or (w,y) with a lower triangle w of an arc (x,y) whose exact weight
+         changes. The arcs are taken from a heap by rank of their lower ends, so
+         every arc is done after (or before) all those it depends on.
+         */
+        template<typename EdgesT>
+        void Update(const std::vector<unsigned> & edgeIDs, const EdgesT & edges) {
+            CHASSERT(customized, "Metric not customized");
+            typedef std::pair<unsigned, unsigned> RankArc;
+            std::priority_queue<RankArc, std::vector<RankArc>, std::greater<RankArc> > bottomUp;
+            for(unsigned i = 0; i < edgeIDs.size(); ++i) {
+                const unsigned arc = topology->inputArc[edgeIDs[i]];
+                if(arc == SPECIAL_EDGEID || queued[arc])
+                    continue;
+                _SetInputWeights(arc, edges);
+                queued[arc] = true;
+                bottomUp.push(RankArc(topology->arcTail[arc], arc));
+            }
+
+            std::vector<unsigned> changed;
+            while(!bottomUp.empty()) {
+                const unsigned w = bottomUp.top().first, arc = bottomUp.top().second;
+                bottomUp.pop();
+                queued[arc] = false;
+                const EdgeWeight oldUp = up[arc], oldDown = down[arc];
+                _CustomizeArc(w, arc);
+                if(up[arc] == oldUp && down[arc] == oldDown)
+                    continue;
+                changed.push_back(w);
+                const unsigned x = topology->arcHead[arc];
+                for(unsigned a = topology->firstArc[w]; a < topology->firstArc[w+1]; ++a) {
+                    const unsigned y = topology->arcHead[a];
+                    if(y == x)
+                        continue;
+                    const unsigned next = topology->FindArc(std::min(x, y), std::max(x, y));
+                    if(!queued[next]) {
+                        queued[next] = true;
+                        bottomUp.push(RankArc(std::min(x, y), next));
+                    }
+                }
+            }
+
+            std::priority_queue<RankArc> topDown;
+            for(unsigned i = 0; i < changed.size(); ++i) {
+                for(unsigned a = topology->firstArc[changed[i]]; a < topology->firstArc[changed[i]+1]; ++a)
+                    _Queue(topDown, changed[i], a);
+            }
+            const std::vector<std::pair<unsigned, unsigned> > & lower = topology->lowerArcs;
+            while(!topDown.empty()) {
+                const unsigned x = topDown.top().first, arc = topDown.top().second;
+                topDown.pop();
+                queued[arc] = false;
+                const EdgeWeight oldUp = exactUp[arc], oldDown = exactDown[arc];
+                _ExactArc(x, arc);
+                if(exactUp[arc] == oldUp && exactDown[arc] == oldDown)
+                    continue;
+                const unsigned y = topology->arcHead[arc];
+                unsigned i = topology->firstLowerArc[x], j = topology->firstLowerArc[y];
+                const unsigned iEnd = topology->firstLowerArc[x+1], jEnd = topology->firstLowerArc[y+1];
+                while(i < iEnd && j < jEnd) {
+                    if(lower[i].first < lower[j].first) {
+                        ++i;
+                    } else if(lower[j].first < lower[i].first) {
+                        ++j;
+                    } else {
+                        _Queue(topDown, lower[i].first, lower[i].second);
+                        _Queue(topDown, lower[j].first, lower[j].second);
+                        ++i;
+                        ++j;
+                    }
+                }
+            }
+        }
+
+        /*
+         The upward arcs as edges of a query graph, between the original node IDs.
+         An arc is left out in a direction in which a path over another node z above
+         its lower end x is as short, which a query can take instead, just as the
+         contraction of x skips a shortcut with a witness. As the shortcuts are
+         unpacked through their middle nodes, the arcs they are made of are kept
+         all the same.
+         */
+        template<typename InputEdgeT>
+        void GetEdges(std::vector<InputEdgeT> & edges) const {
+            const unsigned numberOfArcs = topology->GetNumberOfArcs();
+            std::vector<char> keepUp(numberOfArcs), keepDown(numberOfArcs);
+            const int numberOfNodes = topology->numberOfNodes;
+#pragma omp parallel for schedule ( guided )
+            for(int r = 0; r < numberOfNodes; ++r) {
+                for(unsigned a = topology->firstArc[r]; a < topology->firstArc[r+1]; ++a) {
+                    keepUp[a] = up[a] != UINT_MAX && !_Covered(r, a, true);
+                    keepDown[a] = down[a] != UINT_MAX && !_Covered(r, a, false);
+                }
+            }
+            for(int r = numberOfNodes - 1; r >= 0; --r) {
+                for(unsigned a = topology->firstArc[r]; a < topology->firstArc[r+1]; ++a) {
+                    if(keepUp[a] && upMiddle[a] != SPECIAL_NODEID) {
+                        keepDown[topology->FindArc(upMiddle[a], r)] = true;
+                        keepUp[topology->FindArc(upMiddle[a], topology->arcHead[a])] = true;
+                    }
+                    if(keepDown[a] && downMiddle[a] != SPECIAL_NODEID) {
+                        keepDown[topology->FindArc(downMiddle[a], topology->arcHead[a])] = true;
+                        keepUp[topology->FindArc(downMiddle[a], r)] = true;
+                    }
+                }
+            }
+
+            edges.clear();
+            for(int r = 0; r < numberOfNodes; ++r) {
+                for(unsigned a = topology->firstArc[r]; a < topology->firstArc[r+1]; ++a) {
+                    if(keepUp[a] && keepDown[a] && up[a] == down[a] && upMiddle[a] == downMiddle[a]) {
+                        _AddEdge(r, a, up[a], upMiddle[a], true, true, edges);
+                        continue;
+                    }
+                    if(keepUp[a])
+                        _AddEdge(r, a, up[a], upMiddle[a], true, false, edges);
+                    if(keepDown[a])
+                        _AddEdge(r, a, down[a], downMiddle[a], false, true, edges);
+                }
+            }
+        }
+
+    private:
+        //The smallest weights of the input edges along an arc, which are at least 1 as in the Contractor
+        template<typename EdgesT>
+        void _SetInputWeights(const unsigned arc, const EdgesT & edges) {
+            inputUp[arc] = inputDown[arc] = UINT_MAX;
+            for(unsigned i = topology->firstInput[arc]; i < topology->firstInput[arc+1]; ++i) {
+                const typename EdgesT::value_type & edge = edges[topology->arcInputs[i]];
+                const bool up = topology->rank[edge.source()] < topology->rank[edge.target()];
+                if(edge.isForward()) {
+                    EdgeWeight & w = up ? inputUp[arc] : inputDown[arc];
+                    w = std::min(w, std::max(edge.weight(), 1u));
+                }
+                if(edge.isBackward()) {
+                    EdgeWeight & w = up ? inputDown[arc] : inputUp[arc];
+                    w = std::min(w, std::max(edge.weight(), 1u));
+                }
+            }
+        }
+
+        template<typename HeapT>
+        void _Queue(HeapT & heap, const unsigned x, const unsigned arc) {
+            if(!queued[arc]) {
+                queued[arc] = true;
+                heap.push(std::make_pair(x, arc));
+            }
+        }
+
+        void _CustomizeArc(const unsigned v, const unsigned arc) {
+            const unsigned u = topology->arcHead[arc];
+            EdgeWeight bestUp = inputUp[arc], bestDown = inputDown[arc];
+            unsigned middleUp = SPECIAL_NODEID, middleDown = SPECIAL_NODEID;
+
+            //The lower triangles are the nodes in both lists of lower neighbours
+            const std::vector<std::pair<unsigned, unsigned> > & lower = topology->lowerArcs;
+            unsigned i = topology->firstLowerArc[v], j = topology->firstLowerArc[u];
+            const unsigned iEnd = topology->firstLowerArc[v+1], jEnd = topology->firstLowerArc[u+1];
+            while(i < iEnd && j < jEnd) {
+                if(lower[i].first < lower[j].first) {
+                    ++i;
+                } else if(lower[j].first < lower[i].first) {
+                    ++j;
+                } else {
+                    const unsigned w = lower[i].first, toV = lower[i].second, toU = lower[j].second;
+                    //v-w-u goes down the arc to v and up the arc to u, and u-w-v the other way round
+                    _Relax(down[toV], up[toU], w, bestUp, middleUp);
+                    _Relax(down[toU], up[toV], w, bestDown, middleDown);
+                    ++i;
+                    ++j;
+                }
+            }
+            up[arc] = bestUp;
+            down[arc] = bestDown;
+            upMiddle[arc] = middleUp;
+            downMiddle[arc] = middleDown;
+        }
+
+        /*
+         The exact distances along the arcs (perfect customization). A shortest path
+         between the ends x < y of an arc which leaves the nodes below x does so first
+         at some z, and the part up to z only has nodes below x, so the weight of the
+         arc to z after the bottom up pass is exact - as is that of the arc between z
+         and y, whose lower end is above x and which has been done already in this
+         top down pass.
+         */
+        void _ExactArc(const unsigned x, const unsigned arc) {
+            EdgeWeight bestUp = up[arc], bestDown = down[arc];
+            unsigned toZ, zY, middle;
+            bool upper;
+            _Triangles triangles(*topology, x, arc);
+            while(triangles.Next(toZ, zY, upper)) {
+                //over an upper z the path x-z-y goes up and then down, and the other way round
+                if(upper) {
+                    _Relax(up[toZ], exactDown[zY], 0, bestUp, middle);
+                    _Relax(exactUp[zY], down[toZ], 0, bestDown, middle);
+                } else {
+                    _Relax(up[toZ], exactUp[zY], 0, bestUp, middle);
+                    _Relax(exactDown[zY], down[toZ], 0, bestDown, middle);
+                }
+            }
+            exactUp[arc] = bestUp;
+            exactDown[arc] = bestDown;
+        }
+
+        //Whether the exact distance along an arc from rank x, upwards or downwards, is also that of a path over another node
+        bool _Covered(const unsigned x, const unsigned arc, const bool upwards) const {
+            const EdgeWeight weight = upwards ? exactUp[arc] : exactDown[arc];
+            unsigned toZ, zY;
+            bool upper;
+            _Triangles triangles(*topology, x, arc);
+            while(triangles.Next(toZ, zY, upper)) {
+                EdgeWeight first, second;
+                if(upwards) {
+                    first = exactUp[toZ];
+                    second = upper ? exactDown[zY] : exactUp[zY];
+                } else {
+                    first = upper ? exactUp[zY] : exactDown[zY];
+                    second = exactDown[toZ];
+                }
+                //Arcs of weight 0 could be left out for one another
+                if(first != UINT_MAX && second != UINT_MAX && first > 0 && second > 0 &&
+                   (unsigned long long)first + second <= weight)
+                    return true;
+            }
+            return false;
+        }
+
+        static void _Relax(const EdgeWeight first, const EdgeWeight second, const unsigned middle,
+                           EdgeWeight & best, unsigned & bestMiddle) {
+            const unsigned long long via = (unsigned long long)first + second;
+            if(via < best) {
+                best = via;
+                bestMiddle = middle;
+            }
+        }
+
+        /*
+         The intermediate and upper triangles of the arc from rank x to y, i.e. the
+         other upper neighbours z of x, which are all neighbours of y: for each one
+         the arc from x to z and the arc between z and y, and whether z is above y.
+         */
+        class _Triangles {
+        public:
+            _Triangles(const CCHTopology & _topology, const unsigned x, const unsigned _arc) :
+                topology(_topology), arc(_arc), y(_topology.arcHead[_arc]), i(_topology.firstArc[x]),
+                end(_topology.firstArc[x+1]), j(_topology.firstLowerArc[y]) {}
+
+            bool Next(unsigned & toZ, unsigned & zY, bool & upper) {
+                //Those below y are among its lower neighbours, both lists being sorted
+                const std::vector<std::pair<unsigned, unsigned> > & lower = topology.lowerArcs;
+                if(i < arc) {
+                    const unsigned z = topology.arcHead[i];
+                    while(lower[j].first < z)
+                        ++j;
+                    toZ = i++;
+                    zY = lower[j].second;
+                    upper = false;
+                    return true;
+                }
+                //and those above among its upper ones
+                if(i == arc) {
+                    ++i;
+                    j = topology.firstArc[y];
+                }
+                if(i < end) {
+                    const unsigned z = topology.arcHead[i];
+                    while(topology.arcHead[j] < z)
+                        ++j;
+                    toZ = i++;
+                    zY = j;
+                    upper = true;
+                    return true;
+                }
+                return false;
+            }
+
+        private:
+            const CCHTopology & topology;
+            const unsigned arc, y;
+            unsigned i, end, j;
+        };
+
+        template<typename InputEdgeT>
+        void _AddEdge(const unsigned r, const unsigned arc, const EdgeWeight weight, const unsigned middle,
+                      const bool forward, const bool backward, std::vector<InputEdgeT> & edges) const {
+            InputEdgeT edge;
+            edge.source = topology->order[r];
+            edge.target = topology->order[topology->arcHead[arc]];
+            edge.data.distance = weight;
+            edge.data.shortcut = middle != SPECIAL_NODEID;
+            edge.data.forward = forward;
+            edge.data.backward = backward;
+            edge.data.type = 0;
+            edge.data.middleName.middle = edge.data.shortcut ? topology->order[middle] : 0;
+            edges.push_back(edge);
+        }
+
+        std::shared_ptr<const CCHTopology> topology;
+        //The smallest weights of the input edges along each arc, upwards and downwards
+        std::vector<EdgeWeight> inputUp;
+        std::vector<EdgeWeight> inputDown;
+        //The customized weights, UINT_MAX if there is no path, and the ranks of the
+        //middle nodes of the shortcuts, SPECIAL_NODEID for input edges
+        std::vector<EdgeWeight> up;
+        std::vector<EdgeWeight> down;
+        std::vector<unsigned> upMiddle;
+        std::vector<unsigned> downMiddle;
+        //The exact distances along the arcs, the weights above being upper bounds
+        std::vector<EdgeWeight> exactUp;
+        std::vector<EdgeWeight> exactDown;
+        bool customized;
+        //Whether each arc is in the heap of an update
+        std::vector<bool> queued;
+    };
+}
+
+#endif // CUSTOMIZABLECH_H_INCLUDED
@@ -39,6 +39,8 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #else
 #define omp_get_thread_num() 0
 #define omp_get_max_threads() 1
+#define omp_get_num_threads() 1
+#define omp_set_num_threads(n)
 #endif
 class Contractor {
 
@@ -102,17 +104,19 @@ private:
 
 public:
 
-    template< class InputEdge >
-    Contractor( const int nodes, const std::vector< InputEdge >& inputEdges, const unsigned eqf = 8, const unsigned oqf = 4, const unsigned df = 2) : edgeQuotionFactor(eqf), originalQuotientFactor(oqf), depthFactor(df) {
+    //inputEdges is a std::vector of edges or any container with size() and operator[] giving them
+    template< class InputEdges >
+    Contractor( const int nodes, const InputEdges& inputEdges, const unsigned eqf = 8, const unsigned oqf = 4, const unsigned df = 2) : edgeQuotionFactor(eqf), originalQuotientFactor(oqf), depthFactor(df) {
 
         std::vector< _ImportEdge > edges;
         edges.reserve( 2 * inputEdges.size() );
-        for ( typename std::vector< InputEdge >::const_iterator i = inputEdges.begin(), e = inputEdges.end(); i != e; ++i ) {
+        for ( size_t n = 0; n < inputEdges.size(); ++n ) {
+            const typename InputEdges::value_type input = inputEdges[n];
             _ImportEdge edge;
-            edge.source = i->source();
-            edge.target = i->target();
+            edge.source = input.source();
+            edge.target = input.target();
             
-            edge.data.distance = std::max((int)i->weight(), 1 );
+            edge.data.distance = std::max((int)input.weight(), 1 );
             assert( edge.data.distance > 0 );
 #ifdef DEBUG
             if ( edge.data.distance > 24 * 60 * 60 * 10 ) {
@@ -121,14 +125,14 @@ public:
             }
 #endif
             edge.data.shortcut = false;
-            edge.data.middleName.nameID = i->name();
-            edge.data.forward = i->isForward();
-            edge.data.backward = i->isBackward();
+            edge.data.middleName.nameID = input.name();
+            edge.data.forward = input.isForward();
+            edge.data.backward = input.isBackward();
             edge.data.originalEdges = 1;
             edges.push_back( edge );
             std::swap( edge.source, edge.target );
-            edge.data.forward = i->isBackward();
-            edge.data.backward = i->isForward();
+            edge.data.forward = input.isBackward();
+            edge.data.backward = input.isForward();
             edges.push_back( edge );
         }
 //        std::vector< InputEdge >().swap( inputEdges ); //free memory
@@ -284,32 +288,50 @@ public:
                 }
             }
 
-            //insert new edges
-            for ( unsigned threadNum = 0; threadNum < maxThreads; ++threadNum ) {
-                _ThreadData& data = *threadData[threadNum];
-                for ( int i = 0; i < ( int ) data.insertedEdges.size(); ++i ) {
-                    const _ImportEdge& edge = data.insertedEdges[i];
+            //insert new edges - the sources are split into ranges, and the edges of each
+            //range from all threads are checked for duplicates in parallel, against the
+            //adjacency of their sources and one another. Only the new edges are then
+            //inserted serially, as InsertEdge may move the edges of the graph
+            const int numberOfRanges = 16 * maxThreads;
+            std::vector< std::vector< _ImportEdge > > newEdges( numberOfRanges );
+#pragma omp parallel for schedule ( dynamic )
+            for ( int range = 0; range < numberOfRanges; ++range ) {
+                _ImportEdge first, last;
+                first.source = ( unsigned long long ) numberOfNodes * range / numberOfRanges;
+                last.source = ( unsigned long long ) numberOfNodes * ( range + 1 ) / numberOfRanges;
+                first.target = last.target = 0;
+                std::vector< _ImportEdge >& edges = newEdges[range];
+                for ( unsigned threadNum = 0; threadNum < maxThreads; ++threadNum ) {
+                    const std::vector< _ImportEdge >& inserted = threadData[threadNum]->insertedEdges;
+                    edges.insert( edges.end(), std::lower_bound( inserted.begin(), inserted.end(), first ),
+                                  std::lower_bound( inserted.begin(), inserted.end(), last ) );
+                }
+                std::sort( edges.begin(), edges.end() );
+
+                unsigned kept = 0;
+                for ( unsigned i = 0; i < edges.size(); ++i ) {
+                    const _ImportEdge edge = edges[i];
                     bool found = false;
-                    for ( _DynamicGraph::EdgeIterator e = _graph->BeginEdges( edge.source ) ; e < _graph->EndEdges( edge.source ) ; ++e ) {
-                        const NodeID target = _graph->GetTarget( e );
-                        if ( target != edge.target )
-                            continue;
-                        _EdgeData& data = _graph->GetEdgeData( e );
-                        if ( data.distance != edge.data.distance )
-                            continue;
-                        if ( data.shortcut != edge.data.shortcut )
-                            continue;
-                        if ( data.middleName.middle != edge.data.middleName.middle )
-                            continue;
-                        data.forward |= edge.data.forward;
-                        data.backward |= edge.data.backward;
-                        found = true;
-                        break;
+                    for ( _DynamicGraph::EdgeIterator e = _graph->BeginEdges( edge.source ) ; e < _graph->EndEdges( edge.source ) && !found ; ++e ) {
+                        if ( _graph->GetTarget( e ) == edge.target )
+                            found = _MergeEdge( _graph->GetEdgeData( e ), edge.data );
                     }
+                    //the new edges kept with the same source and target are the last ones
+                    for ( unsigned j = kept; j-- > 0 && edges[j].source == edge.source && edges[j].target == edge.target && !found; )
+                        found = _MergeEdge( edges[j].data, edge.data );
                     if ( !found )
-                        _graph->InsertEdge( edge.source, edge.target, edge.data );
+                        edges[kept++] = edge;
+                }
+                edges.resize( kept );
+            }
+
+            for ( unsigned threadNum = 0; threadNum < maxThreads; ++threadNum )
+                std::vector< _ImportEdge >().swap( threadData[threadNum]->insertedEdges );
+            for ( int range = 0; range < numberOfRanges; ++range ) {
+                for ( unsigned i = 0; i < newEdges[range].size(); ++i ) {
+                    const _ImportEdge& edge = newEdges[range][i];
+                    _graph->InsertEdge( edge.source, edge.target, edge.data );
                 }
-                std::vector< _ImportEdge >().swap( data.insertedEdges );
             }
 
             //update priorities
@@ -370,6 +392,15 @@ public:
 private:
     bool _ConstructCH( _DynamicGraph* _graph );
 
+    //Adds the directions of edge to existing if they are the same edge, returning whether they are
+    static bool _MergeEdge( _EdgeData& existing, const _EdgeData& edge ) {
+        if ( existing.distance != edge.distance || existing.shortcut != edge.shortcut || existing.middleName.middle != edge.middleName.middle )
+            return false;
+        existing.forward |= edge.forward;
+        existing.backward |= edge.backward;
+        return true;
+    }
+
     void _Dijkstra( NodeID source, const int maxDistance, const unsigned numTargets, _ThreadData* data ){
 
         _Heap& heap = data->heap;
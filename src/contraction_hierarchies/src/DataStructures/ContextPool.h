@@ -0,0 +1,75 @@
+#ifndef CONTEXTPOOL_H_INCLUDED
+#define CONTEXTPOOL_H_INCLUDED
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace CH {
+    /*
+     The scratch data of queries, such as the heaps of a search, lent to one query
+     at a time. A query checks a context out for as long as it runs and it goes back
+     to the pool when the Context handle is destroyed. A new one is only made when
+     none is free, so the pool grows to the number of queries that ever ran at once,
+     whichever threads or threading runtime ran them.
+     */
+    template<typename ContextT>
+    class ContextPool {
+    public:
+        //Makes a new context, e.g. heaps sized for the nodes of a graph
+        typedef std::function<ContextT *()> Factory;
+
+        class Context {
+        public:
+            Context(Context && other) : pool(other.pool), context(std::move(other.context)) {}
+            ~Context() {
+                if(context)
+                    pool->Return(std::move(context));
+            }
+
+            ContextT & operator*() const { return *context; }
+            ContextT * operator->() const { return context.get(); }
+
+        private:
+            friend class ContextPool;
+            Context(ContextPool * _pool, std::unique_ptr<ContextT> _context) : pool(_pool), context(std::move(_context)) {}
+            Context(const Context &);
+            Context & operator=(const Context &);
+
+            ContextPool * pool;
+            std::unique_ptr<ContextT> context;
+        };
+
+        explicit ContextPool(Factory _factory) : factory(_factory) {}
+
+        //A context no other query is using, which is the caller's until the handle goes
+        Context Checkout() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if(!free.empty()) {
+                    std::unique_ptr<ContextT> context(std::move(free.back()));
+                    free.pop_back();
+                    return Context(this, std::move(context));
+                }
+            }
+            //Made outside the lock, as it may take a while for a large graph
+            return Context(this, std::unique_ptr<ContextT>(factory()));
+        }
+
+    private:
+        ContextPool(const ContextPool &);
+        ContextPool & operator=(const ContextPool &);
+
+        void Return(std::unique_ptr<ContextT> context) {
+            std::lock_guard<std::mutex> lock(mutex);
+            free.push_back(std::move(context));
+        }
+
+        Factory factory;
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ContextT> > free;
+    };
+}
+
+#endif // CONTEXTPOOL_H_INCLUDED
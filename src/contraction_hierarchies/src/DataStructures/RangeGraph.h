@@ -0,0 +1,187 @@
+#ifndef RANGEGRAPH_H_INCLUDED
+#define RANGEGRAPH_H_INCLUDED
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../BasicDefinitions.h"
+
+namespace CH {
+    /*
+     The edges of a graph without their weights, which the graphs of a network
+     that only differ in their weights share. Besides the input edges it holds
+     the adjacency of the range graph, on which range queries search the
+     original network: every node has an edge to each of its neighbours, going
+     forward if there is an input edge to the neighbour and backward if there is
+     one from it. Both ways are a single edge when all the input edges between
+     the two go both ways, so that they have the same weight whatever the
+     metric, and otherwise separate ones. The weight of an edge of the range
+     graph is the smallest of the input edges it stands for, which are kept.
+     */
+    class EdgeTopology {
+    public:
+        //edges is a std::vector of edges or any container with size() and operator[] giving them
+        template<typename EdgesT>
+        EdgeTopology(unsigned _numberOfNodes, const EdgesT & edges) : numberOfNodes(_numberOfNodes) {
+            sources.resize(edges.size());
+            targets.resize(edges.size());
+            directions.resize(edges.size());
+            for(unsigned i = 0; i < edges.size(); ++i) {
+                const typename EdgesT::value_type edge = edges[i];
+                sources[i] = edge.source();
+                targets[i] = edge.target();
+                directions[i] = (edge.isForward() ? FORWARD : 0) | (edge.isBackward() ? BACKWARD : 0);
+            }
+
+            //Each input edge goes out of its source forward and out of its target backward
+            std::vector<_Half> halves;
+            halves.reserve(2 * edges.size());
+            for(unsigned i = 0; i < edges.size(); ++i) {
+                if(sources[i] == targets[i])
+                    continue;
+                const unsigned char reversed = ((directions[i] & FORWARD) ? BACKWARD : 0) | ((directions[i] & BACKWARD) ? FORWARD : 0);
+                _Half out = {sources[i], targets[i], i, directions[i]};
+                _Half in = {targets[i], sources[i], i, reversed};
+                halves.push_back(out);
+                halves.push_back(in);
+            }
+            std::sort(halves.begin(), halves.end());
+
+            firstEdge.assign(numberOfNodes + 1, 0);
+            firstInput.push_back(0);
+            for(unsigned i = 0; i < halves.size(); ) {
+                unsigned end = i;
+                bool bothWays = true;
+                for(; end < halves.size() && halves[end].node == halves[i].node && halves[end].other == halves[i].other; ++end)
+                    bothWays = bothWays && halves[end].directions == (FORWARD | BACKWARD);
+                if(bothWays) {
+                    _AddEdge(halves, i, end, FORWARD | BACKWARD);
+                } else {
+                    _AddEdge(halves, i, end, FORWARD);
+                    _AddEdge(halves, i, end, BACKWARD);
+                }
+                i = end;
+            }
+            for(unsigned node = 0; node < numberOfNodes; ++node)
+                firstEdge[node+1] += firstEdge[node];
+        }
+
+        unsigned GetNumberOfNodes() const { return numberOfNodes; }
+        unsigned GetNumberOfInputEdges() const { return sources.size(); }
+
+        NodeID Source(const unsigned i) const { return sources[i]; }
+        NodeID Target(const unsigned i) const { return targets[i]; }
+        bool IsForward(const unsigned i) const { return directions[i] & FORWARD; }
+        bool IsBackward(const unsigned i) const { return directions[i] & BACKWARD; }
+
+        size_t MemoryUsage() const {
+            return sources.capacity() * sizeof(NodeID) + targets.capacity() * sizeof(NodeID) +
+                directions.capacity() + firstEdge.capacity() * sizeof(unsigned) + edgeTarget.capacity() * sizeof(NodeID) +
+                edgeDirections.capacity() + firstInput.capacity() * sizeof(unsigned) + edgeInputs.capacity() * sizeof(unsigned);
+        }
+
+        static const unsigned char FORWARD = 1;
+        static const unsigned char BACKWARD = 2;
+
+    private:
+        friend class RangeGraph;
+
+        struct _Half {
+            NodeID node;
+            NodeID other;
+            unsigned input;
+            unsigned char directions;
+            bool operator<(const _Half & right) const {
+                if(node != right.node)
+                    return node < right.node;
+                return other < right.other;
+            }
+        };
+
+        //An edge of the range graph for the halves from i to end going in direction
+        void _AddEdge(const std::vector<_Half> & halves, const unsigned i, const unsigned end, const unsigned char direction) {
+            const unsigned before = edgeInputs.size();
+            for(unsigned j = i; j < end; ++j) {
+                if(halves[j].directions & direction)
+                    edgeInputs.push_back(halves[j].input);
+            }
+            if(edgeInputs.size() == before)
+                return;
+            ++firstEdge[halves[i].node + 1];
+            edgeTarget.push_back(halves[i].other);
+            edgeDirections.push_back(direction);
+            firstInput.push_back(edgeInputs.size());
+        }
+
+        unsigned numberOfNodes;
+        //The input edges
+        std::vector<NodeID> sources;
+        std::vector<NodeID> targets;
+        std::vector<unsigned char> directions;
+        //The edges of the range graph out of node n are firstEdge[n] to firstEdge[n+1]-1,
+        //and the input edges of range graph edge e are edgeInputs[firstInput[e]] onwards
+        std::vector<unsigned> firstEdge;
+        std::vector<NodeID> edgeTarget;
+        std::vector<unsigned char> edgeDirections;
+        std::vector<unsigned> firstInput;
+        std::vector<unsigned> edgeInputs;
+    };
+
+    /*
+     The range graph of an EdgeTopology for one metric, which only adds a weight
+     to each of the shared edges. It has the interface of the StaticGraph the
+     queries search, with the edge data made on the fly.
+     */
+    class RangeGraph {
+    public:
+        typedef NodeID NodeIterator;
+        typedef unsigned EdgeIterator;
+
+        struct EdgeData {
+            EdgeWeight distance;
+            bool forward;
+            bool backward;
+        };
+
+        //inputWeights are the weights of the input edges of the topology
+        RangeGraph(std::shared_ptr<const EdgeTopology> _topology, const std::vector<EdgeWeight> & inputWeights) :
+            topology(_topology) {
+            SetWeights(inputWeights);
+        }
+
+        void SetWeights(const std::vector<EdgeWeight> & inputWeights) {
+            CHASSERT(inputWeights.size() == topology->GetNumberOfInputEdges(), "Weights differ from the input edges in number");
+            const int numberOfEdges = topology->edgeTarget.size();
+            weights.resize(numberOfEdges);
+#pragma omp parallel for schedule ( guided )
+            for(int e = 0; e < numberOfEdges; ++e) {
+                EdgeWeight weight = UINT_MAX;
+                for(unsigned i = topology->firstInput[e]; i < topology->firstInput[e+1]; ++i)
+                    weight = std::min(weight, inputWeights[topology->edgeInputs[i]]);
+                weights[e] = std::max(weight, 1u);
+            }
+        }
+
+        unsigned GetNumberOfNodes() const { return topology->numberOfNodes; }
+        unsigned GetNumberOfEdges() const { return weights.size(); }
+
+        EdgeIterator BeginEdges(const NodeIterator n) const { return topology->firstEdge[n]; }
+        EdgeIterator EndEdges(const NodeIterator n) const { return topology->firstEdge[n+1]; }
+        NodeIterator GetTarget(const EdgeIterator e) const { return topology->edgeTarget[e]; }
+
+        EdgeData GetEdgeData(const EdgeIterator e) const {
+            const unsigned char directions = topology->edgeDirections[e];
+            EdgeData data = {weights[e], (directions & EdgeTopology::FORWARD) != 0, (directions & EdgeTopology::BACKWARD) != 0};
+            return data;
+        }
+
+        size_t MemoryUsage() const { return weights.capacity() * sizeof(EdgeWeight); }
+
+    private:
+        std::shared_ptr<const EdgeTopology> topology;
+        std::vector<EdgeWeight> weights;
+    };
+}
+
+#endif // RANGEGRAPH_H_INCLUDED
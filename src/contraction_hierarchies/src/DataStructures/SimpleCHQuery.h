@@ -20,10 +20,10 @@
 
 #ifndef SIMPLECHQUERY_H_INCLUDED
 #define SIMPLECHQUERY_H_INCLUDED
-template<class EdgeDataT, class GraphT, class HeapT>
+template<class EdgeDataT, class GraphT, class HeapT, class RangeGraphT = GraphT>
 class SimpleCHQuery {
 public:
-    SimpleCHQuery(GraphT * g, GraphT * r) : _graph(g), _range(r) {
+    SimpleCHQuery(GraphT * g, RangeGraphT * r) : _graph(g), _range(r), _forwardStart(0) {
         _forwardHeap = new HeapT(_graph->GetNumberOfNodes());
         _backwardHeap = new HeapT(_graph->GetNumberOfNodes());
         _rangeHeap = new HeapT(_range->GetNumberOfNodes());
@@ -79,34 +79,49 @@ public:
             return _upperbound;
         }
 
-        NodeID pathNode = middle;
-        deque< NodeID > packedPath;
+        _UnpackPath(start, middle, target, path);
 
-        while ( pathNode != start ) {
-            pathNode = _forwardHeap->GetData( pathNode ).parent;
-            packedPath.push_front( pathNode );
-        }
-        //        NodeID realStart = pathNode;
-        packedPath.push_back( middle );
-        pathNode = middle;
+        return _upperbound;
+    }
 
-        while ( pathNode != target ){
-            pathNode = _backwardHeap->GetData( pathNode ).parent;
-            packedPath.push_back( pathNode );
+    // the forward half of the queries from start, searched to the end and kept
+    // in the forward heap, so that the queries from start to any number of
+    // targets then only need their backward halves - see the FromForwardSearch
+    // queries, which must follow this call
+    void ComputeForwardSearch(const NodeID start) {
+        NodeID middle = ( NodeID ) 0;
+        unsigned int _upperbound = std::numeric_limits<unsigned int>::max();
+        _forwardHeap->Clear();
+        _backwardHeap->Clear();
+
+        _forwardHeap->Insert(start, 0, start);
+        while ( _forwardHeap->Size() > 0 ) {
+            _RoutingStep( _forwardHeap, _backwardHeap, true, &middle, &_upperbound );
         }
+        _forwardStart = start;
+    }
 
-        path.push_back( packedPath[0] );
-        for(deque<NodeID>::size_type i = 0; i < packedPath.size()-1; i++) {
-            _UnpackEdge(packedPath[i], packedPath[i+1], path);
+    unsigned int ComputeDistanceFromForwardSearch(const NodeID target) {
+        NodeID middle = ( NodeID ) 0;
+        return _BackwardSearch(target, &middle);
+    }
+
+    unsigned int ComputeRouteFromForwardSearch(const NodeID target, vector<NodeID> & path) {
+        NodeID middle = ( NodeID ) 0;
+        unsigned int _upperbound = _BackwardSearch(target, &middle);
+        if ( _upperbound == std::numeric_limits< unsigned int >::max() ) {
+            return _upperbound;
         }
 
-        packedPath.clear();
+        _UnpackPath(_forwardStart, middle, target, path);
 
         return _upperbound;
     }
 
 
-    void RangeQuery(const NodeID start, const unsigned int maxDistance, std::vector<std::pair<NodeID, unsigned> > & resultNodes) {
+    // with reverse set this finds the nodes from which start can be reached
+    // instead, by following the edges backwards
+    void RangeQuery(const NodeID start, const unsigned int maxDistance, std::vector<std::pair<NodeID, unsigned> > & resultNodes, const bool reverse = false) {
         _rangeHeap->Clear();
         _rangeHeap->Insert(start, 0, start);
         
@@ -115,14 +130,14 @@ public:
             const unsigned distance = _rangeHeap->GetKey( node ); //_forwardHeap->GetKey( node );
             resultNodes.push_back(std::make_pair(node, distance));
             
-            for ( typename GraphT::EdgeIterator edge = _range->BeginEdges( node ); edge < _range->EndEdges(node); edge++ ) {
+            for ( typename RangeGraphT::EdgeIterator edge = _range->BeginEdges( node ); edge < _range->EndEdges(node); edge++ ) {
                 const NodeID to = _range->GetTarget(edge);
                 const EdgeWeight edgeWeight = _range->GetEdgeData(edge).distance;
                 
                 assert( edgeWeight > 0 );
                 const unsigned int toDistance = distance + edgeWeight;
                 
-                if(toDistance <= maxDistance && _range->GetEdgeData(edge).forward) {
+                if(toDistance <= maxDistance && (reverse ? _range->GetEdgeData(edge).backward : _range->GetEdgeData(edge).forward)) {
                     //New Node discovered -> Add to Heap + Node Info Storage
                     if ( !_rangeHeap->WasInserted( to ) ) {
                         _rangeHeap->Insert( to, toDistance, node );
@@ -149,7 +164,7 @@ public:
                 return distance;
             }
             
-            for ( typename GraphT::EdgeIterator edge = _range->BeginEdges( node ); edge < _range->EndEdges(node); edge++ ) {
+            for ( typename RangeGraphT::EdgeIterator edge = _range->BeginEdges( node ); edge < _range->EndEdges(node); edge++ ) {
                 const NodeID to = _range->GetTarget(edge);
                 const EdgeWeight edgeWeight = _range->GetEdgeData(edge).distance;
                 
@@ -174,6 +189,44 @@ public:
     }
 private:
 
+    // the backward half of a query to target against the labels of the last
+    // ComputeForwardSearch, which are left as they are
+    unsigned int _BackwardSearch(const NodeID target, NodeID * middle) {
+        unsigned int _upperbound = std::numeric_limits<unsigned int>::max();
+        _backwardHeap->Clear();
+
+        _backwardHeap->Insert(target, 0, target);
+        while ( _backwardHeap->Size() > 0 ) {
+            _RoutingStep( _backwardHeap, _forwardHeap, false, middle, &_upperbound );
+        }
+        return _upperbound;
+    }
+
+    void _UnpackPath(const NodeID start, const NodeID middle, const NodeID target, vector<NodeID> & path) {
+        NodeID pathNode = middle;
+        deque< NodeID > packedPath;
+
+        while ( pathNode != start ) {
+            pathNode = _forwardHeap->GetData( pathNode ).parent;
+            packedPath.push_front( pathNode );
+        }
+        //        NodeID realStart = pathNode;
+        packedPath.push_back( middle );
+        pathNode = middle;
+
+        while ( pathNode != target ){
+            pathNode = _backwardHeap->GetData( pathNode ).parent;
+            packedPath.push_back( pathNode );
+        }
+
+        path.push_back( packedPath[0] );
+        for(deque<NodeID>::size_type i = 0; i < packedPath.size()-1; i++) {
+            _UnpackEdge(packedPath[i], packedPath[i+1], path);
+        }
+
+        packedPath.clear();
+    }
+
     void _RoutingStep(HeapT * _forwardHeap, HeapT *_backwardHeap, const bool& forwardDirection, NodeID * middle, unsigned int * _upperbound) {
         const NodeID node = _forwardHeap->DeleteMin();
         const unsigned int distance = _forwardHeap->GetKey( node );
@@ -271,10 +324,11 @@ private:
 
 
     GraphT * _graph;
-    GraphT * _range;
+    RangeGraphT * _range;
     HeapT * _forwardHeap;
     HeapT * _backwardHeap;
     HeapT * _rangeHeap;
+    NodeID _forwardStart;
 
 };
 
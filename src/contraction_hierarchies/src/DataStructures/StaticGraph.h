@@ -54,7 +54,8 @@ public:
 #endif
         _numNodes = nodes;
         _numEdges = ( EdgeIterator ) graph.size();
-        _nodes.resize( _numNodes + 1);
+        _nodeStorage.resize( _numNodes + 1);
+        _nodes = &_nodeStorage[0];
         EdgeIterator edge = 0;
         EdgeIterator position = 0;
         for ( NodeIterator node = 0; node <= _numNodes; ++node ) {
@@ -65,7 +66,8 @@ public:
             _nodes[node].firstEdge = position; //=edge
             position += edge - lastEdge; //remove
         }
-        _edges.resize( position ); //(edge)
+        _edgeStorage.resize( position ); //(edge)
+        _edges = _edgeStorage.empty() ? NULL : &_edgeStorage[0];
         edge = 0;
 
         for ( NodeIterator node = 0; node < _numNodes; ++node ) {
@@ -80,6 +82,25 @@ public:
         }
     }
 
+    //A graph over the arrays written out by NodeArray and EdgeArray, which are
+    //owned by the caller and must outlive the graph - e.g. a mapped file
+    StaticGraph( int nodes, int edges, void * nodeArray, void * edgeArray ) {
+        _numNodes = nodes;
+        _numEdges = edges;
+        _nodes = static_cast<_StrNode *>(nodeArray);
+        _edges = static_cast<_StrEdge *>(edgeArray);
+    }
+
+    //The sizes of the records in the raw arrays, which depend on the build
+    static size_t NodeRecordSize() { return sizeof(_StrNode); }
+    static size_t EdgeRecordSize() { return sizeof(_StrEdge); }
+
+    //The raw arrays of the graph, with their sizes in bytes
+    const void * NodeArray() const { return _nodes; }
+    size_t NodeArraySize() const { return ( _numNodes + 1 ) * sizeof(_StrNode); }
+    const void * EdgeArray() const { return _edges; }
+    size_t EdgeArraySize() const { return _numEdges * sizeof(_StrEdge); }
+
     unsigned GetNumberOfNodes() const {
         return _numNodes;
     }
@@ -151,8 +172,13 @@ private:
     NodeIterator _numNodes;
     EdgeIterator _numEdges;
 
-    std::vector< _StrNode > _nodes;
-    std::vector< _StrEdge > _edges;
+    _StrNode * _nodes;
+    _StrEdge * _edges;
+    std::vector< _StrNode > _nodeStorage;
+    std::vector< _StrEdge > _edgeStorage;
+
+    StaticGraph( const StaticGraph & );
+    StaticGraph & operator=( const StaticGraph & );
 };
 
 #endif // STATICGRAPH_H_INCLUDED
@@ -0,0 +1,159 @@
+#ifndef MANYTOMANY_H_INCLUDED
+#define MANYTOMANY_H_INCLUDED
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../BasicDefinitions.h"
+#include "../DataStructures/BinaryHeap.h"
+#include "../DataStructures/ContextPool.h"
+#include "../POIIndex/POIIndex.h"
+
+namespace CH {
+    /*
+     The buckets of a many-to-many query (Knopp et al. 2007). The search up the
+     hierarchy backwards from each target leaves an entry (target, distance) at
+     every node it settles, and these are stored for all the nodes in one flat
+     array - the entries of node u are entries[firstEntry[u]] to
+     entries[firstEntry[u+1]-1], where the node of an entry is the index of
+     its target.
+     */
+    struct ManyToManyBuckets {
+        std::vector<unsigned> firstEntry;
+        std::vector<BucketEntry> entries;
+        unsigned numberOfTargets;
+
+        //Sort the search spaces of the targets into buckets by node
+        void Build(unsigned numberOfNodes, const std::vector<std::vector<BucketEntry> > & searchSpaces) {
+            numberOfTargets = searchSpaces.size();
+            firstEntry.assign(numberOfNodes + 1, 0);
+            for(unsigned t = 0; t < searchSpaces.size(); ++t) {
+                for(unsigned i = 0; i < searchSpaces[t].size(); ++i)
+                    ++firstEntry[searchSpaces[t][i].node + 1];
+            }
+            for(unsigned node = 0; node < numberOfNodes; ++node)
+                firstEntry[node+1] += firstEntry[node];
+
+            entries.resize(firstEntry[numberOfNodes]);
+            std::vector<unsigned> fill(firstEntry.begin(), firstEntry.end() - 1);
+            for(unsigned t = 0; t < searchSpaces.size(); ++t) {
+                for(unsigned i = 0; i < searchSpaces[t].size(); ++i) {
+                    const BucketEntry & e = searchSpaces[t][i];
+                    entries[fill[e.node]++] = BucketEntry(t, e.distance);
+                }
+            }
+        }
+
+        /*
+         The distances to targets firstTarget onwards from a node whose upward search
+         space is searchSpace, UINT_MAX if unreachable. On a graph where every edge
+         goes both ways the backward search space of a node is also its forward
+         one, so the spaces found for the buckets can be scanned directly. The
+         entries of a bucket are sorted by target, so the targets before
+         firstTarget are skipped with a binary search.
+         */
+        void Scan(const std::vector<BucketEntry> & searchSpace, EdgeWeight * row, unsigned firstTarget = 0) const {
+            std::fill(row + firstTarget, row + numberOfTargets, UINT_MAX);
+            const BucketEntry first(firstTarget, 0);
+            for(unsigned i = 0; i < searchSpace.size(); ++i) {
+                const NodeID node = searchSpace[i].node;
+                const EdgeWeight distance = searchSpace[i].distance;
+                std::vector<BucketEntry>::const_iterator e = std::lower_bound(
+                    entries.begin() + firstEntry[node], entries.begin() + firstEntry[node+1], first, ByTarget);
+                for(; e != entries.begin() + firstEntry[node+1]; ++e)
+                    row[e->node] = std::min(row[e->node], distance + e->distance);
+            }
+        }
+
+    private:
+        static bool ByTarget(const BucketEntry & a, const BucketEntry & b) {
+            return a.node < b.node;
+        }
+    };
+
+    /*
+     Distance tables on the contracted graph. Every shortest path in the hierarchy
+     goes up from the source and then down to the target, so after the backward
+     searches from all targets have filled the buckets, one forward search from a
+     source meets every target at the nodes of its search space, and the distance
+     to the target is the smallest sum over those meetings. Both searches prune
+     nodes whose distance is already beaten through a higher node (stall-on-demand).
+     */
+    template<typename QueryGraphT>
+    class ManyToMany {
+    public:
+        ManyToMany(QueryGraphT * _graph) : graph(_graph),
+            heapPool([_graph] { return new POIHeap(_graph->GetNumberOfNodes()); }) {}
+
+        //The nodes settled by the search up the hierarchy backwards from target, with their distances to it
+        void BackwardSearch(const NodeID target, std::vector<BucketEntry> & searchSpace) {
+            ContextPool<POIHeap>::Context context = heapPool.Checkout();
+            POIHeap & heap = *context;
+            searchSpace.clear();
+            heap.Clear();
+            heap.Insert(target, 0, target);
+            while(heap.Size() > 0) {
+                const NodeID node = heap.DeleteMin();
+                const EdgeWeight distance = heap.GetKey(node);
+                if(Stalled(heap, node, distance, true))
+                    continue;
+                searchSpace.push_back(BucketEntry(node, distance));
+                Relax(heap, node, distance, false);
+            }
+        }
+
+        //The distance from source to every target of the buckets, UINT_MAX if it can't be reached
+        void ForwardSearch(const NodeID source, const ManyToManyBuckets & buckets, EdgeWeight * row) {
+            ContextPool<POIHeap>::Context context = heapPool.Checkout();
+            POIHeap & heap = *context;
+            std::fill(row, row + buckets.numberOfTargets, UINT_MAX);
+            heap.Clear();
+            heap.Insert(source, 0, source);
+            while(heap.Size() > 0) {
+                const NodeID node = heap.DeleteMin();
+                const EdgeWeight distance = heap.GetKey(node);
+                if(Stalled(heap, node, distance, false))
+                    continue;
+                for(unsigned i = buckets.firstEntry[node]; i < buckets.firstEntry[node+1]; ++i) {
+                    const BucketEntry & e = buckets.entries[i];
+                    row[e.node] = std::min(row[e.node], distance + e.distance);
+                }
+                Relax(heap, node, distance, true);
+            }
+        }
+
+    private:
+        //Whether node is reached at a shorter distance over an edge from a node in the heap
+        bool Stalled(POIHeap & heap, const NodeID node, const EdgeWeight distance, const bool backwardSearch) {
+            for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge) {
+                const bool into = backwardSearch ? graph->GetEdgeData(edge).forward : graph->GetEdgeData(edge).backward;
+                if(!into)
+                    continue;
+                const NodeID to = graph->GetTarget(edge);
+                if(heap.WasInserted(to) && heap.GetKey(to) + graph->GetEdgeData(edge).distance < distance)
+                    return true;
+            }
+            return false;
+        }
+
+        void Relax(POIHeap & heap, const NodeID node, const EdgeWeight distance, const bool forward) {
+            for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge) {
+                const bool out = forward ? graph->GetEdgeData(edge).forward : graph->GetEdgeData(edge).backward;
+                if(!out)
+                    continue;
+                const NodeID to = graph->GetTarget(edge);
+                const EdgeWeight toDistance = distance + graph->GetEdgeData(edge).distance;
+                if(!heap.WasInserted(to))
+                    heap.Insert(to, toDistance, node);
+                else if(toDistance < heap.GetKey(to))
+                    heap.DecreaseKey(to, toDistance);
+            }
+        }
+
+        QueryGraphT * graph;
+        ContextPool<POIHeap> heapPool;
+    };
+}
+
+#endif // MANYTOMANY_H_INCLUDED
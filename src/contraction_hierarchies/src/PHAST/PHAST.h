@@ -0,0 +1,298 @@
+#ifndef PHAST_H_INCLUDED
+#define PHAST_H_INCLUDED
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "../BasicDefinitions.h"
+#include "../DataStructures/BinaryHeap.h"
+#include "../DataStructures/ContextPool.h"
+
+//Number of sources whose distances are swept down the hierarchy together
+#define PHAST_BATCH 4
+
+namespace CH {
+    //No need to store anything in the Heap for an encountered node besides its distance
+    struct _PHASTHeapData {
+        _PHASTHeapData(NodeID p) {}
+    };
+    typedef BinaryHeap<NodeID, NodeID, EdgeWeight, _PHASTHeapData, ArrayStorage<NodeID, NodeID> > PHASTHeap;
+
+    /*
+     One-to-all queries on the contracted graph (PHAST, Delling et al. 2011). A query
+     searches upwards from the source like the forward half of a CH query, then makes
+     one linear sweep over all nodes from the top of the hierarchy down, relaxing the
+     downward edges into each node. This touches every node, but as a scan of flat
+     arrays rather than a heap, so it wins over Dijkstra on the range graph when the
+     radius covers a good part of the network. The sweep carries the distances of up
+     to PHAST_BATCH sources side by side, so that relaxing an edge is a short loop the
+     compiler can vectorize.
+     */
+    template<typename QueryGraphT>
+    class PHAST {
+        struct _DownEdge {
+            unsigned source;
+            EdgeWeight weight;
+        };
+
+    public:
+        PHAST(QueryGraphT * _graph) : graph(_graph),
+            contextPool([_graph] { return new _QueryContext(_graph->GetNumberOfNodes()); }) {
+            BuildSweep();
+        }
+
+        //The memory of the sweep, without that of the query contexts
+        size_t MemoryUsage() const {
+            return (sweepOrder.capacity() + position.capacity() + firstDownEdge.capacity()) * sizeof(unsigned) +
+                downEdges.capacity() * sizeof(_DownEdge);
+        }
+
+        //The nodes within maxDistance of each of the sources, sorted by distance
+        void RangeQuery(const std::vector<NodeID> & sources, const unsigned maxDistance,
+                        std::vector<std::vector<std::pair<NodeID, unsigned> > > & resultNodes) {
+            CHASSERT(sources.size() <= PHAST_BATCH, "Too many sources for one sweep");
+            const unsigned numberOfNodes = graph->GetNumberOfNodes();
+            typename ContextPool<_QueryContext>::Context context = contextPool.Checkout();
+            _QueryContext & data = *context;
+            EdgeWeight * distances = data.Distances(numberOfNodes);
+
+            for(unsigned j = 0; j < sources.size(); ++j)
+                UpwardSearch(sources[j], maxDistance, j, &position[0], distances, data);
+            Sweep(numberOfNodes, firstDownEdge, downEdges, distances);
+
+            resultNodes.resize(sources.size());
+            for(unsigned j = 0; j < sources.size(); ++j) {
+                std::vector<std::pair<unsigned, NodeID> > & reached = data.reached;
+                reached.clear();
+                for(unsigned pos = 0; pos < numberOfNodes; ++pos) {
+                    const EdgeWeight distance = distances[pos * PHAST_BATCH + j];
+                    if(distance <= maxDistance)
+                        reached.push_back(std::make_pair(distance, sweepOrder[pos]));
+                }
+                std::sort(reached.begin(), reached.end());
+                resultNodes[j].clear();
+                for(unsigned i = 0; i < reached.size(); ++i)
+                    resultNodes[j].push_back(std::make_pair(reached[i].second, reached[i].first));
+            }
+        }
+
+        /*
+         RPHAST (Delling et al. 2011): the part of the hierarchy which can be swept
+         down to a fixed set of targets, i.e. the targets and every node above them
+         with a downward path to one. This is extracted once, after which a query
+         from a source is its upward search plus a sweep over just this part.
+         */
+        class TargetSet {
+        public:
+            TargetSet() {}
+            const std::vector<NodeID> & Targets() const { return targetNodes; }
+        private:
+            friend class PHAST;
+            std::vector<unsigned> index;            //index of each node in the restricted sweep, UINT_MAX if not in it
+            std::vector<unsigned> firstDownEdge;
+            std::vector<_DownEdge> downEdges;        //sources are restricted indexes
+            std::vector<unsigned> targets;           //restricted index of each target
+            std::vector<NodeID> targetNodes;
+            unsigned numberOfNodes;
+        };
+
+        void CreateTargetSet(const std::vector<NodeID> & targets, TargetSet & targetSet) const {
+            const unsigned numberOfNodes = graph->GetNumberOfNodes();
+
+            //Going up the sweep from the bottom, every node with a downward edge to a
+            //selected node is selected too
+            std::vector<bool> selected(numberOfNodes, false);
+            for(unsigned i = 0; i < targets.size(); ++i) {
+                CHASSERT(targets[i] < numberOfNodes, "Target node out of bounds");
+                selected[position[targets[i]]] = true;
+            }
+            for(unsigned pos = numberOfNodes; pos-- > 0; ) {
+                if(!selected[pos])
+                    continue;
+                for(unsigned edge = firstDownEdge[pos]; edge < firstDownEdge[pos+1]; ++edge)
+                    selected[downEdges[edge].source] = true;
+            }
+
+            std::vector<unsigned> restricted(numberOfNodes, UINT_MAX);
+            targetSet.index.assign(numberOfNodes, UINT_MAX);
+            targetSet.numberOfNodes = 0;
+            for(unsigned pos = 0; pos < numberOfNodes; ++pos) {
+                if(selected[pos]) {
+                    restricted[pos] = targetSet.numberOfNodes++;
+                    targetSet.index[sweepOrder[pos]] = restricted[pos];
+                }
+            }
+
+            targetSet.firstDownEdge.assign(targetSet.numberOfNodes + 1, 0);
+            targetSet.downEdges.clear();
+            for(unsigned pos = 0; pos < numberOfNodes; ++pos) {
+                if(!selected[pos])
+                    continue;
+                for(unsigned edge = firstDownEdge[pos]; edge < firstDownEdge[pos+1]; ++edge) {
+                    _DownEdge down = {restricted[downEdges[edge].source], downEdges[edge].weight};
+                    targetSet.downEdges.push_back(down);
+                }
+                targetSet.firstDownEdge[restricted[pos] + 1] = targetSet.downEdges.size();
+            }
+
+            targetSet.targetNodes = targets;
+            targetSet.targets.resize(targets.size());
+            for(unsigned i = 0; i < targets.size(); ++i)
+                targetSet.targets[i] = targetSet.index[targets[i]];
+        }
+
+        //The distance from each of the sources to every target, UINT_MAX if it can't be reached
+        void TargetQuery(const TargetSet & targetSet, const std::vector<NodeID> & sources,
+                         std::vector<std::vector<EdgeWeight> > & resultDistances) {
+            CHASSERT(sources.size() <= PHAST_BATCH, "Too many sources for one sweep");
+            typename ContextPool<_QueryContext>::Context context = contextPool.Checkout();
+            _QueryContext & data = *context;
+            EdgeWeight * distances = data.Distances(targetSet.numberOfNodes);
+
+            for(unsigned j = 0; j < sources.size(); ++j)
+                UpwardSearch(sources[j], InfiniteDistance(), j, &targetSet.index[0], distances, data);
+            Sweep(targetSet.numberOfNodes, targetSet.firstDownEdge, targetSet.downEdges, distances);
+
+            resultDistances.resize(sources.size());
+            for(unsigned j = 0; j < sources.size(); ++j) {
+                resultDistances[j].resize(targetSet.targets.size());
+                for(unsigned i = 0; i < targetSet.targets.size(); ++i) {
+                    const EdgeWeight distance = distances[targetSet.targets[i] * PHAST_BATCH + j];
+                    resultDistances[j][i] = distance < InfiniteDistance() ? distance : UINT_MAX;
+                }
+            }
+        }
+
+    private:
+        //Half of the largest weight, so that adding an edge to it can't overflow
+        static EdgeWeight InfiniteDistance() { return UINT_MAX / 2; }
+
+        struct _QueryContext {
+            PHASTHeap heap;
+            std::vector<EdgeWeight> distances;
+            std::vector<std::pair<unsigned, NodeID> > reached;
+            _QueryContext(unsigned nodes) : heap(nodes) {}
+
+            //The distances of a batch of sources for the first nodes of a sweep, all infinite
+            EdgeWeight * Distances(unsigned nodes) {
+                if(distances.size() < nodes * PHAST_BATCH)
+                    distances.resize(nodes * PHAST_BATCH);
+                std::fill(distances.begin(), distances.begin() + nodes * PHAST_BATCH, InfiniteDistance());
+                return &distances[0];
+            }
+        };
+
+        /*
+         The edges of a node all lead to nodes contracted after it, so sweeping down
+         means visiting every node after all the nodes it has edges to. The sweep
+         order is found by peeling nodes off the top of the hierarchy, and the
+         downward edges are stored by sweep position so the sweep reads them in order.
+         */
+        void BuildSweep() {
+            const unsigned numberOfNodes = graph->GetNumberOfNodes();
+
+            //The nodes below each node, as a list of in-edges from the top
+            std::vector<unsigned> pendingEdges(numberOfNodes, 0);
+            std::vector<unsigned> firstBelow(numberOfNodes + 1, 0);
+            for(NodeID node = 0; node < numberOfNodes; ++node) {
+                for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge) {
+                    ++pendingEdges[node];
+                    ++firstBelow[graph->GetTarget(edge) + 1];
+                }
+            }
+            for(NodeID node = 0; node < numberOfNodes; ++node)
+                firstBelow[node+1] += firstBelow[node];
+            std::vector<NodeID> below(firstBelow[numberOfNodes]);
+            std::vector<unsigned> fill(firstBelow.begin(), firstBelow.end() - 1);
+            for(NodeID node = 0; node < numberOfNodes; ++node) {
+                for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge)
+                    below[fill[graph->GetTarget(edge)]++] = node;
+            }
+
+            sweepOrder.clear();
+            sweepOrder.reserve(numberOfNodes);
+            for(NodeID node = 0; node < numberOfNodes; ++node) {
+                if(pendingEdges[node] == 0)
+                    sweepOrder.push_back(node);
+            }
+            for(unsigned i = 0; i < sweepOrder.size(); ++i) {
+                const NodeID node = sweepOrder[i];
+                for(unsigned b = firstBelow[node]; b < firstBelow[node+1]; ++b) {
+                    if(--pendingEdges[below[b]] == 0)
+                        sweepOrder.push_back(below[b]);
+                }
+            }
+            CHASSERT(sweepOrder.size() == numberOfNodes, "Contracted graph is not a hierarchy");
+
+            position.resize(numberOfNodes);
+            for(unsigned pos = 0; pos < numberOfNodes; ++pos)
+                position[sweepOrder[pos]] = pos;
+
+            //An edge at node to a higher node with the backward flag can be taken downwards
+            firstDownEdge.assign(numberOfNodes + 1, 0);
+            downEdges.clear();
+            for(unsigned pos = 0; pos < numberOfNodes; ++pos) {
+                const NodeID node = sweepOrder[pos];
+                for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge) {
+                    if(graph->GetEdgeData(edge).backward) {
+                        _DownEdge down = {position[graph->GetTarget(edge)], static_cast<EdgeWeight>(graph->GetEdgeData(edge).distance)};
+                        downEdges.push_back(down);
+                    }
+                }
+                firstDownEdge[pos+1] = downEdges.size();
+            }
+        }
+
+        //Plain Dijkstra up the hierarchy from source, seeding column j of the sweep at
+        //the sweep index of each node settled, if it has one
+        void UpwardSearch(const NodeID source, const unsigned maxDistance, const unsigned j,
+                          const unsigned * index, EdgeWeight * distances, _QueryContext & data) {
+            PHASTHeap & heap = data.heap;
+            heap.Clear();
+            heap.Insert(source, 0, source);
+            while(heap.Size() > 0) {
+                const NodeID node = heap.DeleteMin();
+                const EdgeWeight distance = heap.GetKey(node);
+                if(distance > maxDistance)
+                    break;
+                if(index[node] != UINT_MAX)
+                    distances[index[node] * PHAST_BATCH + j] = distance;
+
+                for(typename QueryGraphT::EdgeIterator edge = graph->BeginEdges(node); edge < graph->EndEdges(node); ++edge) {
+                    if(!graph->GetEdgeData(edge).forward)
+                        continue;
+                    const NodeID to = graph->GetTarget(edge);
+                    const EdgeWeight toDistance = distance + graph->GetEdgeData(edge).distance;
+                    if(!heap.WasInserted(to))
+                        heap.Insert(to, toDistance, node);
+                    else if(toDistance < heap.GetKey(to))
+                        heap.DecreaseKey(to, toDistance);
+                }
+            }
+        }
+
+        //Every downward edge comes from a node earlier in the sweep
+        static void Sweep(const unsigned numberOfNodes, const std::vector<unsigned> & firstDown,
+                          const std::vector<_DownEdge> & down, EdgeWeight * distances) {
+            for(unsigned pos = 0; pos < numberOfNodes; ++pos) {
+                EdgeWeight * d = &distances[pos * PHAST_BATCH];
+                for(unsigned edge = firstDown[pos]; edge < firstDown[pos+1]; ++edge) {
+                    const EdgeWeight * from = &distances[down[edge].source * PHAST_BATCH];
+                    const EdgeWeight weight = down[edge].weight;
+                    for(unsigned j = 0; j < PHAST_BATCH; ++j)
+                        d[j] = std::min(d[j], from[j] + weight);
+                }
+            }
+        }
+
+        QueryGraphT * graph;
+        std::vector<NodeID> sweepOrder;
+        std::vector<unsigned> position;
+        std::vector<unsigned> firstDownEdge;
+        std::vector<_DownEdge> downEdges;
+        ContextPool<_QueryContext> contextPool;
+    };
+}
+
+#endif // PHAST_H_INCLUDED
@@ -26,6 +26,7 @@ using std::shared_ptr;
 
 #include "../BasicDefinitions.h"
 #include "../DataStructures/BinaryHeap.h"
+#include "../DataStructures/ContextPool.h"
 
 namespace CH {
     struct BucketEntry {
@@ -51,24 +52,29 @@ namespace CH {
     template<typename QueryGraphT>
     class POIIndex {
     public:
-        POIIndex(QueryGraphT * _graph, unsigned _maxNumberOfPOIsInBucket, unsigned _maxDistanceToConsider) :
-        graph(_graph), maxNumberOfPOIsInBucket(_maxNumberOfPOIsInBucket), maxDistanceToConsider(_maxDistanceToConsider),
-        numberOfThreads(1) {
+        POIIndex(QueryGraphT * _graph, unsigned _maxDistanceToConsider, unsigned _maxNumberOfPOIsInBucket) :
+        graph(_graph), maxNumberOfPOIsInBucket(_maxNumberOfPOIsInBucket), maxDistanceToConsider(_maxDistanceToConsider) {
             Initialize();
         }
 
-        POIIndex(QueryGraphT * _graph, unsigned _maxDistanceToConsider, unsigned _maxNumberOfPOIsInBucket, unsigned _numberOfThreads) :
-        graph(_graph), maxNumberOfPOIsInBucket(_maxNumberOfPOIsInBucket), maxDistanceToConsider(_maxDistanceToConsider),
-        numberOfThreads(_numberOfThreads) {
-            Initialize();
+        ~POIIndex() {
+            bucketIndex.clear();
         }
 
-        ~POIIndex() {
+        //Index the POIs added so far again on graph, which has the same nodes with
+        //new edges - the old graph may be gone already
+        void SetGraph(QueryGraphT * _graph) {
+            graph = _graph;
             bucketIndex.clear();
+            std::vector<NodeID> added;
+            added.swap(pois);
+            for(unsigned i = 0; i < added.size(); ++i)
+                addPOIToIndex(added[i]);
         }
 
         inline void addPOIToIndex(const NodeID node){
             CHASSERT(node < graph->GetNumberOfNodes(), "Node ID of POI is out of bounds");
+            pois.push_back(node);
             additionHeap->Clear();
             CHASSERT(additionHeap->Size() == 0, "AdditionHeap not empty");
             //explore search space from node v
@@ -137,31 +143,17 @@ namespace CH {
             getNearestPOIs(node, resultingVenues, maxDistanceToConsider, maxQueryNumberOfLocationsToConsider);
         }
 
-        //Multi-threaded functions
-
-        inline void getNearestPOIs(NodeID node, std::vector<BucketEntry>& resultingVenues, unsigned threadID){
-            getNearestPOIs(node, resultingVenues, maxDistanceToConsider, maxNumberOfPOIsInBucket, threadID);
-        }
-
-        inline void getNearestPOIsWithUpperBoundOnDistance(NodeID node, unsigned maxQueryDistanceToConsider, std::vector<BucketEntry>& resultingVenues, unsigned threadID){
-            getNearestPOIs(node, resultingVenues, maxQueryDistanceToConsider, maxNumberOfPOIsInBucket, threadID);
-        }
-
-        inline void getNearestPOIsWithUpperBoundOnLocations(NodeID node, unsigned maxQueryNumberOfLocationsToConsider, std::vector<BucketEntry>& resultingVenues, unsigned threadID){
-            getNearestPOIs(node, resultingVenues, maxDistanceToConsider, maxQueryNumberOfLocationsToConsider, threadID);
-        }
-
-        //Main query function. Both for single and multithreaded
+        //Main query function, which any number of threads may run at once
 
-        inline void getNearestPOIs(NodeID node, std::vector<BucketEntry>& resultingVenues, unsigned _maxDistanceToConsider, unsigned _maxNumberOfPOIsInBucket, unsigned threadID = 0){
-            CHASSERT(threadID < numberOfThreads, "Invalid thread ID");
+        inline void getNearestPOIs(NodeID node, std::vector<BucketEntry>& resultingVenues, unsigned _maxDistanceToConsider, unsigned _maxNumberOfPOIsInBucket){
             //INFO("Search for nearest venues close to node " << node);
             //INFO("_maxDistanceToConsider: " << _maxDistanceToConsider << ", _maxNumberOfPOIsInBucket: " << _maxNumberOfPOIsInBucket);
             CHASSERT(0 == resultingVenues.size(), "Resulting vector of getNearestQuery is not empty");
             CHASSERT(_maxDistanceToConsider <= maxDistanceToConsider, "Maximum distance to POIs must not be larger in query than during preprocessing");
             CHASSERT(_maxNumberOfPOIsInBucket <= maxNumberOfPOIsInBucket, "Maximumum number of POIs must not be larger in query than during preprocessing");
-            POIHeap & resultHeap = threadDataArray[threadID]->resultHeap;
-            POIHeap & queryHeap = threadDataArray[threadID]->queryHeap;
+            typename ContextPool<_QueryContext>::Context context = contextPool->Checkout();
+            POIHeap & resultHeap = context->resultHeap;
+            POIHeap & queryHeap = context->queryHeap;
             resultHeap.Clear();
 
             queryHeap.Clear();
@@ -181,12 +173,13 @@ namespace CH {
                 }
 
                 //check if there is a bucket entry at that node
-                if(bucketIndex.find(currentNode) != bucketIndex.end()) {
-                    Bucket & bucket = bucketIndex[currentNode];
+                const BucketIndex::const_iterator found = bucketIndex.find(currentNode);
+                if(found != bucketIndex.end()) {
+                    const Bucket & bucket = found->second;
                    // INFO("Found bucket of size " << bucket.size() << " at node " << currentNode);
                     //put all venues at bucket into result heap that are closer than maximum distance
                     for(unsigned i = 0; i < bucket.size(); i++){
-                        BucketEntry & b = bucket[i];
+                        const BucketEntry & b = bucket[i];
                         const unsigned distanceToPOI = toDistance + b.distance;
                         //Do we already know this guy?
                         //INFO("Looking at bucket entry " << b.node << "-" << b.distance);
@@ -254,26 +247,26 @@ namespace CH {
             //queryCount = 0;
             additionHeap.reset(new POIHeap(graph->GetNumberOfNodes()));
             //bucketIndex.set_empty_key(UINT_MAX);
-            CHASSERT(numberOfThreads > 0, "Number of threads must be a non-negative integer");
-            for(unsigned i = 0; i < numberOfThreads; ++i)
-                threadDataArray.push_back(std::shared_ptr<_ThreadData>(new _ThreadData(graph->GetNumberOfNodes()) ) );
+            const unsigned numberOfNodes = graph->GetNumberOfNodes();
+            contextPool.reset(new ContextPool<_QueryContext>([numberOfNodes] { return new _QueryContext(numberOfNodes); }));
         }
 
-        struct _ThreadData {
-            _ThreadData() {
+        //The heaps of a query, checked out of the pool shared by the copies of the index
+        struct _QueryContext {
+            _QueryContext() {
                 assert(false);
             }
-            _ThreadData(unsigned size) :queryHeap(size), resultHeap(size) { }
+            _QueryContext(unsigned size) :queryHeap(size), resultHeap(size) { }
             POIHeap queryHeap;
             POIHeap resultHeap;
         };
         QueryGraphT * graph;
         unsigned maxNumberOfPOIsInBucket;
         unsigned maxDistanceToConsider;
-        unsigned numberOfThreads;
         BucketIndex bucketIndex;
+        std::vector<NodeID> pois;
         std::shared_ptr<POIHeap> additionHeap;
-        std::vector<std::shared_ptr<_ThreadData> > threadDataArray;
+        std::shared_ptr<ContextPool<_QueryContext> > contextPool;
         //int queryCount;
     };
 }
@@ -18,6 +18,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 or see http://www.gnu.org/licenses/agpl.txt.
  */
 
+#include <cstring>
+
 #include "libch.h"
 #include "POIIndex/POIIndex.h"
 #if defined(_OPENMP) && (defined(__amd64__) || defined(__i386__))
@@ -29,35 +31,26 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
     os << "[" << e.name() << "]= (" << e.source() << (e.backward ? "<" : "") << "-" << (e.forward ? ">" : "") << e.target() << ")|" << e.weight();
     return os;
 }
-    ContractionHierarchies::ContractionHierarchies() : numberOfThreads(1){
+    ContractionHierarchies::ContractionHierarchies() : numberOfNodes(0){
         contractor  = NULL;
         staticGraph = NULL;
         rangeGraph = NULL;
-    }
-
-    ContractionHierarchies::ContractionHierarchies(unsigned _n) : numberOfThreads(_n){
-        CHASSERT(numberOfThreads != 0, "At least one query thread must be given");
-        contractor  = NULL;
-        staticGraph = NULL;
-		rangeGraph = NULL;
-//#ifdef _OPENMP
-//        omp_set_num_threads(12);
-//#endif
+        queryPool = NULL;
+        phast = NULL;
+        manyToMany = NULL;
     }
 
     ContractionHierarchies::~ContractionHierarchies() {
-        nodeVector.clear();
-
-        for(unsigned i = 0; i < queryObjects.size(); i++) {
-            delete queryObjects[i];
-        }
         poiIndexMap.clear();
-        queryObjects.clear();
+        targetSetMap.clear();
         
         //delete all objects, clean up space
         CHDELETE (contractor );
+        CHDELETE (queryPool);
         CHDELETE (staticGraph);
         CHDELETE (rangeGraph);
+        CHDELETE (phast);
+        CHDELETE (manyToMany);
 
     }
 
@@ -66,28 +59,28 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 	}
 
 	void ContractionHierarchies::SetNodeVector( const vector<Node> & nv){
+		//only the number of nodes is used
+		SetNumberOfNodes(nv.size());
+	}
 
-        nodeVector.reserve(nv.size());
-
-		//fill node vector and construct map on the way
-		for(unsigned i = 0; i < nv.size(); i++) {
-			//copy element
-			this->nodeVector.push_back(nv[i]);
-		}
+	void ContractionHierarchies::SetNumberOfNodes( unsigned n ){
+		this->numberOfNodes = n;
 	}
 
 	void ContractionHierarchies::SetEdgeVector( const vector<Edge> & ev) {
+		vector<EdgeWeight> weights(ev.size());
+		for(unsigned i = 0; i < ev.size(); i++)
+			weights[i] = ev[i].weight();
+		SetEdgeVector(std::shared_ptr<const EdgeTopology>(new EdgeTopology(this->numberOfNodes, ev)), weights);
+	}
 
-		CHASSERT(this->nodeVector.size(), "NodeVector unset");
-		CHASSERT(!this->edgeList.size(), "EdgeList already set");
-
-		//fill edge vector and check if each target and source node exists
-		for(unsigned i = 0; i < ev.size(); i++) {
-			this->edgeList.push_back(ev[i]);
-		}
-		CHASSERT(ev.size() == this->edgeList.size(), "edge lists sizes differ");
-		this->contractor = new Contractor( this->nodeVector.size(), this->edgeList );
-        this->rangeGraph = BuildRangeGraph(this->nodeVector.size(), this->edgeList);        
+	void ContractionHierarchies::SetEdgeVector( std::shared_ptr<const EdgeTopology> topology, const vector<EdgeWeight> & weights) {
+		CHASSERT(this->numberOfNodes, "NodeVector unset");
+		CHASSERT(!this->edgeTopology, "EdgeList already set");
+		CHASSERT(topology->GetNumberOfNodes() == this->numberOfNodes, "Topology is for a different number of nodes");
+		CHASSERT(topology->GetNumberOfInputEdges() == weights.size(), "edge lists sizes differ");
+		this->edgeTopology = topology;
+		this->edgeWeights = weights;
 	}
 
 	std::string ContractionHierarchies::GetVersionString () {
@@ -95,13 +88,16 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 	}
 
 	void ContractionHierarchies::RunPreprocessing() {
+		this->rangeGraph = new RangeGraph(this->edgeTopology, this->edgeWeights);
+
 		//build CH
+		this->contractor = new Contractor( this->numberOfNodes, InputEdgeVector(*this->edgeTopology, this->edgeWeights) );
 		this->contractor->Run();
 
 		//clean CH
 		std::vector< ContractionCleanup::Edge > contractedEdges;
 		this->contractor->GetEdges( contractedEdges );
-		ContractionCleanup * cleanup = new ContractionCleanup(this->nodeVector.size(), contractedEdges);
+		ContractionCleanup * cleanup = new ContractionCleanup(this->numberOfNodes, contractedEdges);
 		contractedEdges.clear();
 		cleanup->Run();
 
@@ -110,132 +106,148 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 		delete cleanup;
 
 		//build query object
-		this->staticGraph = new QueryGraph(this->nodeVector.size(), cleanedEdgeList);
-		for(unsigned i = 0; i < numberOfThreads; ++i) {
-		    queryObjects.push_back(new SimpleCHQuery<EdgeData, QueryGraph, Heap>(this->staticGraph, this->rangeGraph));
-		}
+		this->staticGraph = new QueryGraph(this->numberOfNodes, cleanedEdgeList);
+		BuildQueryObjects();
 		//std::cout << "finished constructing query objects" << std::endl;
 		//deconstruct contractor?
 		CHDELETE(this->contractor);
 		//std::cout << "destructed contractor" << std::endl;
 	}
 
-	QueryGraph * ContractionHierarchies::BuildRangeGraph(const int nodes, const std::vector< Edge >& inputEdges) {
-	    QueryGraph * _graph;
-        std::vector< InputEdge > edges;
-        edges.reserve( 2 * inputEdges.size() );
-        for ( std::vector< Edge >::const_iterator i = inputEdges.begin(), e = inputEdges.end(); i != e; ++i ) {
-            InputEdge edge;
-            edge.source = i->source();
-            edge.target = i->target();
-
-            edge.data.distance = std::max((int)i->weight(), 1 );
-
-            assert( edge.data.distance > 0 );
-            edge.data.shortcut = false;
-            edge.data.middleName.nameID = i->name();
-            edge.data.forward = i->isForward();
-            edge.data.backward = i->isBackward();
-            edges.push_back( edge );
-            std::swap( edge.source, edge.target );
-            edge.data.forward = i->isBackward();
-            edge.data.backward = i->isForward();
-            edges.push_back( edge );
-        }
-        sort( edges.begin(), edges.end() );
-        NodeID edge = 0;
-        for ( NodeID i = 0; i < edges.size(); ) {
-            const NodeID source = edges[i].source;
-            const NodeID target = edges[i].target;
-            const NodeID middle = edges[i].data.middleName.nameID;
-
-            assert(edges[i].data.distance > 0);
-            
-           // const short type = 0; //edges[i].data.type;
-            //assert(type >= 0);
-            //remove eigenloops
-            if ( source == target ) {
-                i++;
-                continue;
-            }
-            InputEdge forwardEdge;
-            InputEdge backwardEdge;
-            forwardEdge.source = backwardEdge.source = source;
-            forwardEdge.target = backwardEdge.target = target;
-            forwardEdge.data.forward = backwardEdge.data.backward = true;
-            forwardEdge.data.backward = backwardEdge.data.forward = false;
-            //forwardEdge.data.type = backwardEdge.data.type = type;
-            forwardEdge.data.middleName.nameID = backwardEdge.data.middleName.nameID = middle;
-            forwardEdge.data.shortcut = backwardEdge.data.shortcut = false;
-            forwardEdge.data.distance = backwardEdge.data.distance = std::numeric_limits<int>::max();
-            //remove parallel edges
-            while ( i < edges.size() && edges[i].source == source && edges[i].target == target ) {
-                if ( edges[i].data.forward )
-                    forwardEdge.data.distance = std::min( edges[i].data.distance, forwardEdge.data.distance );
-                if ( edges[i].data.backward )
-                    backwardEdge.data.distance = std::min( edges[i].data.distance, backwardEdge.data.distance );
-                
-                assert(edges[i].data.distance > 0);
-                assert(forwardEdge.data.distance > 0);
-                assert(backwardEdge.data.distance > 0);
-
-                i++;
-            }
-            assert(forwardEdge.data.distance > 0);
-            assert(backwardEdge.data.distance > 0);
-            //merge edges (s,t) and (t,s) into bidirectional edge
-            if ( forwardEdge.data.distance == backwardEdge.data.distance ) {
-                if ( (int)forwardEdge.data.distance != std::numeric_limits< int >::max() ) {
-                    forwardEdge.data.backward = true;
-                    edges[edge++] = forwardEdge;
-                    assert(forwardEdge.data.distance > 0);
-                //    INFO("src: " << forwardEdge.source << ", tgt: " << forwardEdge.target << ", dst: " << forwardEdge.data.distance);
-                }
-            } else { //insert seperate edges
-                if ( (int)forwardEdge.data.distance != std::numeric_limits< int >::max() ) {
-                    edges[edge++] = forwardEdge;
-                //    INFO("src: " << forwardEdge.source << ", tgt: " << forwardEdge.target << ", dst: " << forwardEdge.data.distance);
-                }
-                if ( (int)backwardEdge.data.distance != std::numeric_limits< int >::max() ) {
-                    edges[edge++] = backwardEdge;
-                //    INFO("src: " << backwardEdge.source << ", tgt: " << backwardEdge.target << ", dst: " << backwardEdge.data.distance);
-                }
-            }
-        }
-        
-        FILE_LOG(logINFO) << "Range graph removed " << edges.size() - edge 
-                          << " edges of " << edges.size() << "\n";
-        
-        //INFO("Range graph removed " << edges.size() - edge << " edges of " << edges.size());
-        assert(edge <= edges.size());
-        edges.resize( edge );
-        _graph = new QueryGraph( nodes, edges );
-        std::vector< InputEdge >().swap( edges );
-        return _graph;
-    }
+	void ContractionHierarchies::RunCustomization(std::shared_ptr<const CCHTopology> topology) {
+		CHASSERT(topology->GetNumberOfNodes() == this->numberOfNodes, "Topology is for a different number of nodes");
+		this->rangeGraph = new RangeGraph(this->edgeTopology, this->edgeWeights);
+		this->cchMetric = CCHMetric(topology, InputEdgeVector(*this->edgeTopology, this->edgeWeights));
+		this->cchMetric.Customize();
+		BuildCustomizedGraph();
+	}
 
-    int ContractionHierarchies::computeLengthofShortestPath(const Node &s, const Node& t){
-        return computeLengthofShortestPath(s, t, 0);
-    }
+	std::shared_ptr<const CCHTopology> ContractionHierarchies::CreateCCHTopology() const {
+		CHASSERT(this->edgeTopology, "EdgeList unset");
+		return std::shared_ptr<const CCHTopology>(new CCHTopology(this->numberOfNodes, InputEdgeVector(*this->edgeTopology, this->edgeWeights)));
+	}
+
+	void ContractionHierarchies::UpdateEdgeWeights(const std::vector<unsigned> & edgeIDs, const std::vector<EdgeWeight> & weights,
+	                                               std::shared_ptr<const CCHTopology> topology) {
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+		CHASSERT(edgeIDs.size() == weights.size(), "Edge IDs and weights differ in number");
+		for(unsigned i = 0; i < edgeIDs.size(); ++i) {
+			CHASSERT(edgeIDs[i] < this->edgeWeights.size(), "Edge ID out of bounds");
+			this->edgeWeights[edgeIDs[i]] = weights[i];
+		}
+
+		const InputEdgeVector inputEdges(*this->edgeTopology, this->edgeWeights);
+		if(this->cchMetric.Customized()) {
+			this->cchMetric.Update(edgeIDs, inputEdges);
+		} else {
+			CHASSERT(topology->GetNumberOfNodes() == this->numberOfNodes, "Topology is for a different number of nodes");
+			this->cchMetric = CCHMetric(topology, inputEdges);
+			this->cchMetric.Customize();
+		}
+		this->rangeGraph->SetWeights(this->edgeWeights);
+
+		CHDELETE(this->queryPool);
+		CHDELETE(this->phast);
+		CHDELETE(this->manyToMany);
+		CHDELETE(this->staticGraph);
+		BuildCustomizedGraph();
+
+		//The POI buckets and target sets are made again on the new graph
+		for(CHPOIIndexMap::iterator it = poiIndexMap.begin(); it != poiIndexMap.end(); ++it)
+			it->second.SetGraph(this->staticGraph);
+		for(CHTargetSetMap::iterator it = targetSetMap.begin(); it != targetSetMap.end(); ++it)
+			phast->CreateTargetSet(std::vector<NodeID>(it->second.Targets()), it->second);
+	}
+
+	void ContractionHierarchies::BuildCustomizedGraph() {
+		std::vector< InputEdge> customizedEdgeList;
+		this->cchMetric.GetEdges(customizedEdgeList);
+		this->staticGraph = new QueryGraph(this->numberOfNodes, customizedEdgeList);
+		BuildQueryObjects();
+	}
+
+	void ContractionHierarchies::BuildQueryObjects() {
+		QueryGraph * graph = this->staticGraph;
+		RangeGraph * range = this->rangeGraph;
+		this->queryPool = new CHQueryPool([graph, range] { return new CHQuery(graph, range); });
+		this->phast = new CHPHAST(this->staticGraph);
+		this->manyToMany = new CHManyToMany(this->staticGraph);
+	}
+
+	/*
+	 The graphs are written as a small header followed by the node and edge arrays
+	 of the contracted graph, each padded to 8 bytes so that they stay aligned when
+	 the data is mapped from a file. The range graph is quick to make from the edges.
+	 */
+	struct _GraphsHeader {
+		unsigned numberOfNodes;
+		unsigned staticEdges;
+		unsigned edgeSize;
+		unsigned reserved;
+	};
+
+	static size_t _Padded(size_t size) {
+		return (size + 7) / 8 * 8;
+	}
+
+	static void _WriteArray(std::ostream & out, const void * data, size_t size) {
+		static const char zeros[8] = {0};
+		out.write(static_cast<const char *>(data), size);
+		out.write(zeros, _Padded(size) - size);
+	}
+
+	void ContractionHierarchies::WriteGraphs(std::ostream & out) const {
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+		_GraphsHeader header = {this->numberOfNodes, staticGraph->GetNumberOfEdges(),
+		                        static_cast<unsigned>(QueryGraph::EdgeRecordSize()), 0};
+		_WriteArray(out, &header, sizeof(header));
+		_WriteArray(out, staticGraph->NodeArray(), staticGraph->NodeArraySize());
+		_WriteArray(out, staticGraph->EdgeArray(), staticGraph->EdgeArraySize());
+	}
+
+	bool ContractionHierarchies::CheckGraphs(const char * data, size_t size, unsigned numberOfNodes) {
+		if(size < _Padded(sizeof(_GraphsHeader)))
+			return false;
+		_GraphsHeader header;
+		memcpy(&header, data, sizeof(header));
+		if(header.numberOfNodes != numberOfNodes || header.edgeSize != QueryGraph::EdgeRecordSize())
+			return false;
+		const size_t nodesSize = _Padded((size_t(header.numberOfNodes) + 1) * QueryGraph::NodeRecordSize());
+		const size_t staticSize = _Padded(size_t(header.staticEdges) * header.edgeSize);
+		return size >= _Padded(sizeof(header)) + nodesSize + staticSize;
+	}
+
+	void ContractionHierarchies::ReadGraphs(char * data, size_t size) {
+		CHASSERT(this->staticGraph == NULL && this->contractor == NULL, "Graphs already set");
+		CHASSERT(CheckGraphs(data, size, this->numberOfNodes), "Graph data is not for these nodes or is truncated");
+		_GraphsHeader header;
+		memcpy(&header, data, sizeof(header));
+		const size_t nodesSize = _Padded((size_t(header.numberOfNodes) + 1) * QueryGraph::NodeRecordSize());
+
+		char * staticNodes = data + _Padded(sizeof(header));
+		char * staticEdges = staticNodes + nodesSize;
+		this->staticGraph = new QueryGraph(header.numberOfNodes, header.staticEdges, staticNodes, staticEdges);
+		this->rangeGraph = new RangeGraph(this->edgeTopology, this->edgeWeights);
+		BuildQueryObjects();
+	}
 
-	int ContractionHierarchies::computeLengthofShortestPath(const Node &s, const Node& t, unsigned threadID){
+	int ContractionHierarchies::computeLengthofShortestPath(const Node &s, const Node& t){
 		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-		CHASSERT(queryObjects.size() > threadID, "Accessing invalid threadID");
 		NodeID start(UINT_MAX);
 		NodeID target(UINT_MAX);
 
-		if(s.id < nodeVector.size()) {
+		if(s.id < numberOfNodes) {
 			start = s.id;
 		} else {
 			return UINT_MAX;
 		}
 
-		if(t.id < nodeVector.size()) {
+		if(t.id < numberOfNodes) {
 			target = t.id;
 		} else {
 			return UINT_MAX;
 		}
-		return this->queryObjects[threadID]->ComputeDistanceBetweenNodes(start, target);
+		return this->queryPool->Checkout()->ComputeDistanceBetweenNodes(start, target);
 	}
 
     int ContractionHierarchies::computeVerificationLengthofShortestPath(const Node &s, const Node& t){
@@ -243,63 +255,150 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 		NodeID start(UINT_MAX);
 		NodeID target(UINT_MAX);
         
-		if(s.id < nodeVector.size()) {
+		if(s.id < numberOfNodes) {
 			start = s.id;
 		} else {
 			return UINT_MAX;
 		}
         
-		if(t.id < nodeVector.size()) {
+		if(t.id < numberOfNodes) {
 			target = t.id;
 		} else {
 			return UINT_MAX;
 		}
-		return this->queryObjects[0]->SimpleDijkstraQuery(start, target);
+		return this->queryPool->Checkout()->SimpleDijkstraQuery(start, target);
 	}
 
-    int ContractionHierarchies::computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath){
-        return computeShortestPath(s, t, ResultingPath, 0);
+    /** the lengths of the shortest paths from s to each of the targets, from a single forward search */
+    void ContractionHierarchies::computeLengthsofShortestPaths(const Node &s, const vector<NodeID> & targets, vector<unsigned> & ResultingLengths){
+        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+        ResultingLengths.assign(targets.size(), UINT_MAX);
+
+        if(s.id >= numberOfNodes) {
+            return;
+        }
+
+        CHQueryPool::Context query = queryPool->Checkout();
+        query->ComputeForwardSearch(s.id);
+        for(unsigned i = 0; i < targets.size(); ++i) {
+            if(targets[i] < numberOfNodes)
+                ResultingLengths[i] = query->ComputeDistanceFromForwardSearch(targets[i]);
+        }
     }
-    
-	int ContractionHierarchies::computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath, unsigned threadID){
+
+    /** the shortest paths from s to each of the targets, from a single forward search */
+    void ContractionHierarchies::computeShortestPaths(const Node &s, const vector<NodeID> & targets, vector<vector<NodeID> > & ResultingPaths){
+        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+        ResultingPaths.assign(targets.size(), vector<NodeID>());
+
+        if(s.id >= numberOfNodes) {
+            return;
+        }
+
+        CHQueryPool::Context query = queryPool->Checkout();
+        query->ComputeForwardSearch(s.id);
+        for(unsigned i = 0; i < targets.size(); ++i) {
+            if(targets[i] < numberOfNodes)
+                query->ComputeRouteFromForwardSearch(targets[i], ResultingPaths[i]);
+        }
+    }
+
+	int ContractionHierarchies::computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath){
 		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-        CHASSERT(queryObjects.size() > threadID, "Accessing invalid threadID");
 		NodeID start(UINT_MAX);
 		NodeID target(UINT_MAX);
 
-        if(s.id < nodeVector.size()) {
+        if(s.id < numberOfNodes) {
             start = s.id;
         } else {
             return UINT_MAX;
         }
 
-        if(t.id < nodeVector.size()) {
+        if(t.id < numberOfNodes) {
             target = t.id;
         } else {
             return UINT_MAX;
         }
-		return queryObjects[threadID]->ComputeRoute(start, target, ResultingPath);
+		return queryPool->Checkout()->ComputeRoute(start, target, ResultingPath);
 	}
 
-    void ContractionHierarchies::computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes){
-        computeReachableNodesWithin(s, maxDistance, ResultingNodes, 0);
-    }
-
-	void ContractionHierarchies::computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes, unsigned threadID){
+	void ContractionHierarchies::computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes){
 		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-        CHASSERT(queryObjects.size() > threadID, "Accessing invalid threadID");
         NodeID start(UINT_MAX);
 
-        if(s.id < nodeVector.size()) {
+        if(s.id < numberOfNodes) {
             start = s.id;
         } else {
             return;
         }
 
-        queryObjects[threadID]->RangeQuery(start, maxDistance, ResultingNodes);
+        queryPool->Checkout()->RangeQuery(start, maxDistance, ResultingNodes);
+	}
+
+    /** the nodes from which t can be reached within maxDistance */
+	void ContractionHierarchies::computeNodesReachingWithin(const Node &t, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes){
+		CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
+
+        if(t.id >= numberOfNodes) {
+            return;
+        }
+
+        queryPool->Checkout()->RangeQuery(t.id, maxDistance, ResultingNodes, true);
 	}
+
+    /** the nodes within maxDistance of each of up to PHAST_BATCH sources, from one sweep */
+	void ContractionHierarchies::computeReachableNodesWithinPHAST(const std::vector<NodeID> &sources, unsigned maxDistance, std::vector<ReachedNode> & ResultingNodes){
+		CHASSERT(this->phast != NULL, "Preprocessing not finished");
+        for(unsigned i = 0; i < sources.size(); ++i) {
+            CHASSERT(sources[i] < numberOfNodes, "Source node out of bounds");
+        }
+
+        phast->RangeQuery(sources, maxDistance, ResultingNodes);
+	}
+
+    /** the part of the hierarchy above the targets, extracted once for RPHAST queries */
+    void ContractionHierarchies::createTargetSet(const POIKeyType &name, const std::vector<NodeID> &targets){
+        CHASSERT(this->phast != NULL, "Preprocessing not finished");
+        phast->CreateTargetSet(targets, targetSetMap[name]);
+    }
+
+    /** the distances from each of up to PHAST_BATCH sources to all the targets of a set, UINT_MAX if unreachable */
+    void ContractionHierarchies::computeDistancesToTargets(const POIKeyType &name, const std::vector<NodeID> &sources, std::vector<std::vector<EdgeWeight> > & ResultingDistances){
+        CHASSERT(this->phast != NULL, "Preprocessing not finished");
+        CHTargetSetMap::iterator targetSet = targetSetMap.find(name);
+        if(targetSet == targetSetMap.end()) {
+            ResultingDistances.clear();
+            return;
+        }
+        for(unsigned i = 0; i < sources.size(); ++i) {
+            CHASSERT(sources[i] < numberOfNodes, "Source node out of bounds");
+        }
+
+        phast->TargetQuery(targetSet->second, sources, ResultingDistances);
+    }
+
+    int ContractionHierarchies::getTargetSetSize(const POIKeyType &name) const {
+        CHTargetSetMap::const_iterator targetSet = targetSetMap.find(name);
+        if(targetSet == targetSetMap.end())
+            return -1;
+        return targetSet->second.Targets().size();
+    }
+
+    /** the bucket entries left by the backward search from t, for a many-to-many query */
+    void ContractionHierarchies::computeBackwardSearchSpace(NodeID t, std::vector<BucketEntry> & SearchSpace){
+        CHASSERT(this->manyToMany != NULL, "Preprocessing not finished");
+        CHASSERT(t < numberOfNodes, "Target node out of bounds");
+        manyToMany->BackwardSearch(t, SearchSpace);
+    }
+
+    /** the distances from s to all the targets of the buckets, UINT_MAX if unreachable */
+    void ContractionHierarchies::computeDistancesFromBuckets(NodeID s, const ManyToManyBuckets & buckets, EdgeWeight * ResultingDistances){
+        CHASSERT(this->manyToMany != NULL, "Preprocessing not finished");
+        CHASSERT(s < numberOfNodes, "Source node out of bounds");
+        manyToMany->ForwardSearch(s, buckets, ResultingDistances);
+    }
     
-    /** POI queries single threaded */
+    /** POI indexes, which any number of threads may query at once */
     void ContractionHierarchies::createPOIIndex(const POIKeyType &category, unsigned maxDistanceToConsider,
                                                 unsigned maxNumberOfPOIsInBucket)
     {
@@ -309,7 +408,7 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
 
          // reinitialize this bucket
          poiIndexMap.insert(CHPOIIndexMap::value_type(category, CHPOIIndex(this->staticGraph, maxDistanceToConsider,
-                                                                           maxNumberOfPOIsInBucket, numberOfThreads)));
+                                                                           maxNumberOfPOIsInBucket)));
     }
     
 
@@ -358,42 +457,13 @@ inline ostream& operator<< (ostream& os, const Edge& e) {
     }
     
 
-    /** POI queries multi-threaded */    
-    void ContractionHierarchies::getNearest(const POIKeyType &category, NodeID node, std::vector<BucketEntry>& resultingVenues,
-                                            unsigned threadID) {
-        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-	CHPOIIndexMap::iterator category_poi = poiIndexMap.find(category);
-        if(category_poi != poiIndexMap.end())
-            category_poi->second.getNearestPOIs(node, resultingVenues, threadID);
-    }
-
-    
-    void ContractionHierarchies::getNearestWithUpperBoundOnDistance(const POIKeyType &category, NodeID node,
-                                                                    EdgeWeight maxDistance, std::vector<BucketEntry>& resultingVenues,
-                                                                    unsigned threadID) {
-        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-	CHPOIIndexMap::iterator category_poi = poiIndexMap.find(category);
-        if(category_poi != poiIndexMap.end())
-            category_poi->second.getNearestPOIsWithUpperBoundOnDistance(node, maxDistance, resultingVenues, threadID);
-    }
-    
-
-    void ContractionHierarchies::getNearestWithUpperBoundOnLocations(const POIKeyType &category, NodeID node, unsigned maxLocations,
-                                                                     std::vector<BucketEntry>& resultingVenues, unsigned threadID) {
-        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-	CHPOIIndexMap::iterator category_poi = poiIndexMap.find(category);
-        if(category_poi != poiIndexMap.end())
-            category_poi->second.getNearestPOIsWithUpperBoundOnLocations(node, maxLocations, resultingVenues, threadID);
-    }
-
-
-    void ContractionHierarchies::getNearestWithUpperBoundOnDistanceAndLocations(const POIKeyType &category, NodeID node,
-                                                                                EdgeWeight maxDistance, unsigned maxLocations,
-                                                                                std::vector<BucketEntry>& resultingVenues, unsigned threadID) {
-        CHASSERT(this->staticGraph != NULL, "Preprocessing not finished");
-	CHPOIIndexMap::iterator category_poi = poiIndexMap.find(category);
-        if(category_poi != poiIndexMap.end())
-            category_poi->second.getNearestPOIs(node, resultingVenues, maxDistance, maxLocations, threadID);
+    void ContractionHierarchies::getMemoryUsage(std::map<std::string, size_t> & usage) const {
+        usage["edge weights"] = this->edgeWeights.capacity() * sizeof(EdgeWeight);
+        usage["range graph"] = this->rangeGraph != NULL ? this->rangeGraph->MemoryUsage() : 0;
+        usage["contracted graph"] = this->staticGraph != NULL ?
+            this->staticGraph->NodeArraySize() + this->staticGraph->EdgeArraySize() : 0;
+        usage["phast"] = this->phast != NULL ? this->phast->MemoryUsage() : 0;
+        usage["customization"] = this->cchMetric.MemoryUsage();
     }
 
 }
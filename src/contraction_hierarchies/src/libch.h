@@ -30,9 +30,14 @@ or see http://www.gnu.org/licenses/agpl.txt.
 #include "BasicDefinitions.h"
 #include "Contractor/ContractionCleanup.h"
 #include "Contractor/Contractor.h"
+#include "DataStructures/ContextPool.h"
+#include "DataStructures/RangeGraph.h"
 #include "DataStructures/SimpleCHQuery.h"
 #include "DataStructures/StaticGraph.h"
 #include "POIIndex/POIIndex.h"
+#include "PHAST/PHAST.h"
+#include "ManyToMany/ManyToMany.h"
+#include "CCH/CustomizableCH.h"
 
 #define FILE_LOG(logINFO) (std::cout)
 
@@ -46,12 +51,18 @@ typedef BinaryHeap< NodeID, NodeID, EdgeWeight, _HeapData, ArrayStorage<NodeID,
 typedef ContractionCleanup::Edge::EdgeData EdgeData;
 typedef StaticGraph<EdgeData>::InputEdge InputEdge;
 typedef StaticGraph< EdgeData > QueryGraph;
-typedef vector<SimpleCHQuery<EdgeData, QueryGraph, Heap> > QueryObjectVector;
+typedef SimpleCHQuery<EdgeData, QueryGraph, Heap, CH::RangeGraph> CHQuery;
+typedef CH::ContextPool<CHQuery> CHQueryPool;
 
 typedef CH::POIIndex< QueryGraph > CHPOIIndex;
 typedef std::string POIKeyType;
 typedef std::map<POIKeyType, CHPOIIndex> CHPOIIndexMap;
 
+typedef CH::PHAST< QueryGraph > CHPHAST;
+typedef std::map<POIKeyType, CHPHAST::TargetSet> CHTargetSetMap;
+
+typedef CH::ManyToMany< QueryGraph > CHManyToMany;
+
 namespace CH {
 
 //Note: latitude and longitude are multiplied by 10^6 and internally represented by integers.
@@ -104,57 +115,109 @@ struct Edge {
 
 typedef std::vector<std::pair<NodeID, unsigned> > ReachedNode;
 
-	//The CH Interface will have the following functions:
+//The input edges of a graph, made on the fly from the topology it shares and its own weights
+class InputEdgeVector {
+public:
+    typedef Edge value_type;
+    InputEdgeVector(const EdgeTopology & _topology, const vector<EdgeWeight> & _weights) :
+        topology(_topology), weights(_weights) {}
+    size_t size() const { return weights.size(); }
+    Edge operator[](const unsigned i) const {
+        return Edge(topology.Source(i), topology.Target(i), i, weights[i], topology.IsForward(i), topology.IsBackward(i));
+    }
+private:
+    const EdgeTopology & topology;
+    const vector<EdgeWeight> & weights;
+};
+
+	//The CH Interface will have the following functions. The queries may be run from
+	//any number of threads at once, each taking the query objects it needs from a pool
     class ContractionHierarchies {
 
 	public:
         ContractionHierarchies();
-		ContractionHierarchies(unsigned numberOfThreads);
 		~ContractionHierarchies(void);
 
 		void reset(void);
 		std::string GetVersionString ();
 		void SetNodeVector( const vector<Node> & nv);
+		//Instead of a node vector, as the nodes are only counted
+		void SetNumberOfNodes( unsigned n );
 		void SetEdgeVector( const vector<Edge> & e);
+		//Instead of an edge vector, the edges of topology, shared with other graphs, with these weights
+		void SetEdgeVector( std::shared_ptr<const EdgeTopology> topology, const vector<EdgeWeight> & weights);
+		//The edges of the edge vector set by the above, with their current weights
+		InputEdgeVector GetInputEdges() const { return InputEdgeVector(*this->edgeTopology, this->edgeWeights); }
 		void RunPreprocessing();
+		//Instead of RunPreprocessing, customize topology, which must have been built from
+		//the same edges, with the weights of the edge vector
+		void RunCustomization(std::shared_ptr<const CCHTopology> topology);
+		//A customizable topology of the edge vector, for UpdateEdgeWeights
+		std::shared_ptr<const CCHTopology> CreateCCHTopology() const;
+		//Give the edges edgeIDs (indexes into the edge vector) new weights and customize
+		//the hierarchy again for them. If it was built by RunPreprocessing or ReadGraphs
+		//it is customized from scratch on topology, and later updates only redo the
+		//customization above the changed edges. The POI indexes and target sets are
+		//made again on the new graph
+		void UpdateEdgeWeights(const std::vector<unsigned> & edgeIDs, const std::vector<EdgeWeight> & weights,
+		                       std::shared_ptr<const CCHTopology> topology);
+		//Write the contracted graph to out, for ReadGraphs
+		void WriteGraphs(std::ostream & out) const;
+		//Whether data holds the whole of the graphs written by WriteGraphs for
+		//numberOfNodes nodes by a build with the same record sizes - callers check
+		//this before ReadGraphs, which only asserts it
+		static bool CheckGraphs(const char * data, size_t size, unsigned numberOfNodes);
+		//Use the graphs in data, written by WriteGraphs for the same nodes and edges,
+		//instead of setting the edges and running the preprocessing. data must
+		//outlive this object
+		void ReadGraphs(char * data, size_t size);
         int computeLengthofShortestPath(const Node &s, const Node& t);
-        int computeLengthofShortestPath(const Node &s, const Node& t, unsigned threadID);
         int computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath);
-        int computeShortestPath(const Node &s, const Node& t, vector<NodeID> & ResultingPath, unsigned threadID);
         int computeVerificationLengthofShortestPath(const Node &s, const Node& t);
+        void computeLengthsofShortestPaths(const Node &s, const vector<NodeID> & targets, vector<unsigned> & ResultingLengths);
+        void computeShortestPaths(const Node &s, const vector<NodeID> & targets, vector<vector<NodeID> > & ResultingPaths);
         void computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes);
-        void computeReachableNodesWithin(const Node &s, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes, unsigned threadID);
+        void computeNodesReachingWithin(const Node &t, unsigned maxDistance, std::vector<std::pair<NodeID, unsigned> > & ResultingNodes);
+        void computeReachableNodesWithinPHAST(const std::vector<NodeID> &sources, unsigned maxDistance, std::vector<ReachedNode> & ResultingNodes);
+
+        void createTargetSet(const POIKeyType &name, const std::vector<NodeID> &targets);
+        void computeDistancesToTargets(const POIKeyType &name, const std::vector<NodeID> &sources, std::vector<std::vector<EdgeWeight> > & ResultingDistances);
+        //The number of targets of the set name, -1 if there is no such set
+        int getTargetSetSize(const POIKeyType &name) const;
+
+        void computeBackwardSearchSpace(NodeID t, std::vector<BucketEntry> & SearchSpace);
+        void computeDistancesFromBuckets(NodeID s, const ManyToManyBuckets & buckets, EdgeWeight * ResultingDistances);
 
         void createPOIIndex(const POIKeyType &category, unsigned _maxDistanceToConsider, unsigned _maxNumberOfPOIsInBucket);
         void addPOIToIndex(const POIKeyType &category, NodeID node);
 
         void getNearest(const POIKeyType &category, NodeID node, std::vector<BucketEntry>& resultingVenues);
-        void getNearest(const POIKeyType &category, NodeID node, std::vector<BucketEntry>& resultingVenues, unsigned threadID);
         void getNearestWithUpperBoundOnLocations(const POIKeyType &category, NodeID node, EdgeWeight maxLocations,
                                                  std::vector<BucketEntry>& resultingVenues);
-        void getNearestWithUpperBoundOnLocations(const POIKeyType &category, NodeID node, EdgeWeight maxLocations,
-                                                 std::vector<BucketEntry>& resultingVenues, unsigned threadID);
         void getNearestWithUpperBoundOnDistance(const POIKeyType &category, NodeID node, unsigned maxLocations,
                                                 std::vector<BucketEntry>& resultingVenues);
-        void getNearestWithUpperBoundOnDistance(const POIKeyType &category, NodeID node, unsigned maxLocations,
-                                                std::vector<BucketEntry>& resultingVenues, unsigned threadID);
         void getNearestWithUpperBoundOnDistanceAndLocations(const POIKeyType &category, NodeID node,
                                                             EdgeWeight maxDistance, unsigned maxLocations, std::vector<BucketEntry>& resultingVenues);
-        void getNearestWithUpperBoundOnDistanceAndLocations(const POIKeyType &category, NodeID node,
-                                                            EdgeWeight maxDistance, unsigned maxLocations,
-                                                            std::vector<BucketEntry>& resultingVenues, unsigned threadID);
+
+        //The bytes taken by the parts of the hierarchy which aren't shared with other graphs, by part
+        void getMemoryUsage(std::map<std::string, size_t> & usage) const;
 
 	private:
-		unsigned numberOfThreads;
-		QueryGraph * BuildRangeGraph(const int nodes, const std::vector< Edge >& inputEdges);
-		vector<Node> nodeVector;
-		vector<Edge> edgeList;
+		void BuildCustomizedGraph();
+		void BuildQueryObjects();
+		unsigned numberOfNodes;
+		std::shared_ptr<const EdgeTopology> edgeTopology;
+		vector<EdgeWeight> edgeWeights;
 
 		Contractor* contractor;
+		CCHMetric cchMetric;
 		QueryGraph * staticGraph;
-		QueryGraph * rangeGraph;
-		vector<SimpleCHQuery<EdgeData, QueryGraph, Heap> *> queryObjects;
+		RangeGraph * rangeGraph;
+		CHQueryPool * queryPool;
+		CHPHAST * phast;
+		CHManyToMany * manyToMany;
         CHPOIIndexMap poiIndexMap;
+        CHTargetSetMap targetSetMap;
 	};
 }
 
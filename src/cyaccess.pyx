@@ -5,61 +5,203 @@ from libcpp cimport bool
 from libcpp.vector cimport vector
 from libcpp.string cimport string
 from libcpp.pair cimport pair
+from libcpp.map cimport map
+from cpython.pycapsule cimport PyCapsule_New, PyCapsule_GetPointer
+
+import threading
+from contextlib import contextmanager
 
 import numpy as np
 cimport numpy as np
 
+np.import_array()
+
 # resources
 # http://cython.readthedocs.io/en/latest/src/userguide/wrapping_CPlusPlus.html
 # http://www.birving.com/blog/2014/05/13/passing-numpy-arrays-between-python-and/
 
 
-cdef extern from "accessibility.h" namespace "MTC::accessibility":
+# the calls into the library run without the GIL, so that other Python
+# threads carry on while they do
+cdef extern from "accessibility.h" namespace "MTC::accessibility" nogil:
     cdef cppclass Accessibility:
-        Accessibility(int, vector[vector[long]], vector[vector[double]], bool) except +
+        Accessibility(int, const long *, int, const double *, int, bool, string,
+                      string) except +
         vector[string] aggregations
         vector[string] decays
+        vector[string] engines
         void initializeCategory(double, int, string, vector[long])
-        pair[vector[vector[double]], vector[vector[int]]] findAllNearestPOIs(
-            float, int, string, int)
-        void initializeAccVar(string, vector[long], vector[double])
+        void findAllNearestPOIs(float, int, string, double *, long *, int)
+        void initializeAccVar(string, vector[long], vector[double], int)
         vector[double] getAllAggregateAccessibilityVariables(
-            float, string, string, string, int)
+            float, string, string, string, int, string)
+        vector[double] getAllAggregateAccessibilityVariables(
+            vector[float], string, string, string, int, string)
+        vector[double] getAggregateAccessibilityVariables(
+            vector[long], float, string, string, string, int, string)
+        vector[double] getAggregateAccessibilityVariables(
+            vector[long], vector[float], string, string, string, int, string)
+        vector[double] getManyAggregateAccessibilityVariables(
+            float, vector[string], vector[string], vector[string], int, string)
         vector[int] Route(int, int, int)
-        vector[vector[int]] Routes(vector[long], vector[long], int)
+        void Routes(vector[long], vector[long], int, vector[long] &,
+                    vector[long] &)
         double Distance(int, int, int)
         vector[double] Distances(vector[long], vector[long], int)
-        vector[vector[pair[long, float]]] Range(vector[long], float, int, vector[long])
-        void precomputeRangeQueries(double)
+        void DistanceMatrix(vector[long], vector[long], float *, int)
+        void writeSkim(vector[long], vector[long], string, int, double,
+                       int) except +
+        void initializeTargetSet(string, vector[long])
+        vector[double] getDistancesToTargets(vector[long], string, int)
+        void Range(vector[long], float, int, vector[long], string, vector[long] &,
+                   vector[long] &, vector[float] &)
+        void precomputeRangeQueries(double, string)
+        void saveRangeQueries(string) except +
+        void loadRangeQueries(string) except +
+        void saveContractionHierarchies(string) except +
+        void updateEdgeWeights(vector[long], vector[double], int) except +
+        map[string, size_t] memoryUsage(int) except +
+
+cdef extern from "skim.h" namespace "MTC::accessibility" nogil:
+    cdef cppclass SkimLayout:
+        unsigned long long numrows
+        unsigned long long numcols
+    cdef cppclass SkimReader:
+        SkimReader(string) except +
+        void readRows(unsigned long long, unsigned long long, float *) except +
+        SkimLayout layout
+        vector[long] sources
+        vector[long] targets
+
+
+# results are handed to numpy without copying them - the vector holding
+# them is moved to the heap and owned by a capsule which is the base of the
+# array, so that it is freed along with the array
+cdef void free_vector_dbl(object capsule) noexcept:
+    cdef vector[double] *vec = <vector[double] *> PyCapsule_GetPointer(capsule, NULL)
+    del vec
+
 
+cdef void free_vector_flt(object capsule) noexcept:
+    cdef vector[float] *vec = <vector[float] *> PyCapsule_GetPointer(capsule, NULL)
+    del vec
 
-cdef np.ndarray[double] convert_vector_to_array_dbl(vector[double] vec):
-    cdef np.ndarray arr = np.zeros(len(vec), dtype="double")
-    for i in range(len(vec)):
-        arr[i] = vec[i]
+
+cdef void free_vector_long(object capsule) noexcept:
+    cdef vector[long] *vec = <vector[long] *> PyCapsule_GetPointer(capsule, NULL)
+    del vec
+
+
+cdef np.ndarray convert_vector_to_array_dbl(vector[double] &vec):
+    # vec is left empty
+    cdef vector[double] *owned = new vector[double]()
+    owned.swap(vec)
+    cdef np.npy_intp size = owned.size()
+    cdef np.ndarray arr = np.PyArray_SimpleNewFromData(
+        1, &size, np.NPY_DOUBLE, owned.data())
+    np.set_array_base(arr, PyCapsule_New(owned, NULL, free_vector_dbl))
     return arr
 
 
-cdef np.ndarray[double, ndim = 2] convert_2D_vector_to_array_dbl(
-        vector[vector[double]] vec):
-    cdef np.ndarray arr = np.empty_like(vec, dtype="double")
-    for i in range(arr.shape[0]):
-        for j in range(arr.shape[1]):
-            arr[i][j] = vec[i][j]
+cdef np.ndarray convert_vector_to_array_flt(vector[float] &vec):
+    # vec is left empty
+    cdef vector[float] *owned = new vector[float]()
+    owned.swap(vec)
+    cdef np.npy_intp size = owned.size()
+    cdef np.ndarray arr = np.PyArray_SimpleNewFromData(
+        1, &size, np.NPY_FLOAT, owned.data())
+    np.set_array_base(arr, PyCapsule_New(owned, NULL, free_vector_flt))
     return arr
 
 
-cdef np.ndarray[int, ndim = 2] convert_2D_vector_to_array_int(
-        vector[vector[int]] vec):
-    cdef np.ndarray arr = np.empty_like(vec, dtype="int")
-    for i in range(arr.shape[0]):
-        for j in range(arr.shape[1]):
-            arr[i][j] = vec[i][j]
+cdef np.ndarray convert_vector_to_array_long(vector[long] &vec):
+    # vec is left empty
+    cdef vector[long] *owned = new vector[long]()
+    owned.swap(vec)
+    cdef np.npy_intp size = owned.size()
+    cdef np.ndarray arr = np.PyArray_SimpleNewFromData(
+        1, &size, np.NPY_LONG, owned.data())
+    np.set_array_base(arr, PyCapsule_New(owned, NULL, free_vector_long))
     return arr
 
 
+def read_skim(string filename, long first_row=0, long num_rows=-1):
+    """
+    filename - a skim written by cyaccess.write_skim
+    first_row - the first origin to read
+    num_rows - the number of origins to read, all the rest by default
+
+    Returns a float32 2D array with a row per origin read and a column per
+    destination, with the node ids of those origins and of all the
+    destinations
+    """
+    cdef SkimReader * reader = new SkimReader(filename)
+    cdef np.ndarray[float, ndim=2, mode="c"] arr
+    try:
+        if num_rows < 0:
+            num_rows = reader.layout.numrows - first_row
+        arr = np.empty((num_rows, reader.layout.numcols), dtype=np.float32)
+        with nogil:
+            reader.readRows(first_row, num_rows, <float *> arr.data)
+        sources = np.array(reader.sources, dtype=np.int64)[
+            first_row:first_row + num_rows]
+        targets = np.array(reader.targets, dtype=np.int64)
+    finally:
+        del reader
+    return arr, sources, targets
+
+
+class NetworkLock(object):
+    """
+    Lets any number of threads query a network at once, or one thread
+    change it - the queries take their scratch space from pools in the
+    library, but can't run while the graphs, POIs or variables they read
+    are being replaced.  A thread waiting to change the network keeps new
+    queries out, so that it isn't held up for ever by a stream of them.
+    """
+    def __init__(self):
+        self.cond = threading.Condition()
+        self.readers = 0
+        self.writing = False
+        self.waiting = 0
+
+    @contextmanager
+    def shared(self):
+        with self.cond:
+            while self.writing or self.waiting:
+                self.cond.wait()
+            self.readers += 1
+        try:
+            yield
+        finally:
+            with self.cond:
+                self.readers -= 1
+                if self.readers == 0:
+                    self.cond.notify_all()
+
+    @contextmanager
+    def exclusive(self):
+        with self.cond:
+            self.waiting += 1
+            while self.writing or self.readers:
+                self.cond.wait()
+            self.waiting -= 1
+            self.writing = True
+        try:
+            yield
+        finally:
+            with self.cond:
+                self.writing = False
+                self.cond.notify_all()
+
+
 cdef class cyaccess:
     cdef Accessibility * access
+    cdef int numnodes
+    # the queries share it and the calls which change the network hold it
+    # alone - other threads wait for it without the GIL, so only the
+    # threads using this network are held up
+    cdef object lock
 
     def __cinit__(
         self,
@@ -67,7 +209,9 @@ cdef class cyaccess:
         np.ndarray[double, ndim=2] node_xys,
         np.ndarray[long, ndim=2] edges,
         np.ndarray[double, ndim=2] edge_weights,
-        bool twoway=True
+        bool twoway=True,
+        string hierarchy=b"ch",
+        string ch_file=b""
     ):
         """
         node_ids: vector of node identifiers
@@ -76,11 +220,39 @@ cdef class cyaccess:
         edge_weights: the weights (impedances) that apply to each edge
         twoway: whether the edges should all be two-way or whether they
             are directed from the first to the second node
+        hierarchy: "ch" to contract the graph of each impedance, or "cch"
+            to build a customizable contraction hierarchy once and
+            customize it for each impedance
+        ch_file: a file written by save_ch for the same network, whose
+            contraction hierarchies are used instead of building them
         """
         # you're right, neither the node ids nor the location xys are used in here
         # anymore - I'm hesitant to out-and-out remove it as we might still use
         # it for something someday
-        self.access = new Accessibility(len(node_ids), edges, edge_weights, twoway)
+        self.numnodes = len(node_ids)
+        self.lock = NetworkLock()
+
+        # the edges and weights are read straight from the arrays, which are
+        # only copied if they aren't already contiguous
+        if edges.shape[1] != 2 or edge_weights.shape[1] != edges.shape[0]:
+            raise ValueError("edges and edge_weights don't match")
+        cdef long[:, ::1] edge_nodes = np.ascontiguousarray(edges)
+        cdef double[:, ::1] weights = np.ascontiguousarray(edge_weights)
+        cdef const long *edges_ptr = NULL
+        cdef const double *weights_ptr = NULL
+        if edge_nodes.shape[0] > 0:
+            edges_ptr = &edge_nodes[0, 0]
+        if weights.shape[0] > 0 and weights.shape[1] > 0:
+            weights_ptr = &weights[0, 0]
+        cdef int numnodes = self.numnodes
+        cdef int numedges = edge_nodes.shape[0]
+        cdef int numgraphs = weights.shape[0]
+        cdef Accessibility * access
+        with nogil:
+            access = new Accessibility(numnodes, edges_ptr, numedges,
+                                       weights_ptr, numgraphs, twoway,
+                                       hierarchy, ch_file)
+        self.access = access
 
     def __dealloc__(self):
         del self.access
@@ -100,7 +272,11 @@ cdef class cyaccess:
         category - the category name
         node_ids - an array of nodeids which are locations where this poi occurs
         """
-        self.access.initializeCategory(maxdist, maxitems, category, node_ids)
+        cdef vector[long] nodes = node_ids
+        with self.lock.exclusive():
+            with nogil:
+                self.access.initializeCategory(maxdist, maxitems, category,
+                                               nodes)
 
     def find_all_nearest_pois(
         self,
@@ -114,26 +290,42 @@ cdef class cyaccess:
         num_of_pois - number of pois to search for
         category - the category name
         impno - the impedance id to use
-        return_nodeids - whether to return the nodeid locations of the nearest
-            not just the distances
-        """
-        ret = self.access.findAllNearestPOIs(radius, num_of_pois, category, impno)
 
-        return convert_2D_vector_to_array_dbl(ret.first),\
-            convert_2D_vector_to_array_int(ret.second)
+        Returns 2D arrays of the distances to the nearest pois of each node
+        and of the indexes of those pois, with a row per node and -1 where
+        there are fewer pois
+        """
+        cdef np.ndarray[double, ndim=2, mode="c"] dists = np.empty(
+            (self.numnodes, num_of_pois), dtype="double")
+        cdef np.ndarray[long, ndim=2, mode="c"] poi_ids = np.empty(
+            (self.numnodes, num_of_pois), dtype=np.int_)
+        with self.lock.shared():
+            with nogil:
+                self.access.findAllNearestPOIs(radius, num_of_pois, category,
+                                               <double *> dists.data,
+                                               <long *> poi_ids.data, impno)
+        return dists, poi_ids
 
     def initialize_access_var(
         self,
         string category,
         np.ndarray[long] node_ids,
-        np.ndarray[double] values
+        np.ndarray[double] values,
+        int quantile_bins=0
     ):
         """
         category - category name
         node_ids: vector of node identifiers
         values: vector of values that are location at the nodes
+        quantile_bins: if positive, approximate the quantile aggregations
+            with a sketch of this many bins
         """
-        self.access.initializeAccVar(category, node_ids, values)
+        cdef vector[long] nodes = node_ids
+        cdef vector[double] vals = values
+        with self.lock.exclusive():
+            with nogil:
+                self.access.initializeAccVar(category, nodes, vals,
+                                             quantile_bins)
 
     def get_available_aggregations(self):
         return self.access.aggregations
@@ -141,25 +333,125 @@ cdef class cyaccess:
     def get_available_decays(self):
         return self.access.decays
 
+    def get_available_engines(self):
+        return self.access.engines
+
     def get_all_aggregate_accessibility_variables(
         self,
-        double radius,
+        radius,
         category,
         aggtyp,
         decay,
         int impno=0,
+        engine=b"dijkstra",
     ):
         """
-        radius - search radius
+        radius - search radius, or a list of radii in which case a single
+            search at the largest radius is shared by all of them and a 2-D
+            array with a row per radius is returned
         category - category name
         aggtyp - aggregation type, see docs
         decay - decay type, see docs
         impno - the impedance id to use
+        engine - range query engine, see get_available_engines
         """
-        ret = self.access.getAllAggregateAccessibilityVariables(
-            radius, category, aggtyp, decay, impno)
+        cdef vector[float] radii
+        cdef vector[double] ret
+        cdef float r
+        cdef string cat = category, agg = aggtyp, dec = decay, eng = engine
+        if np.ndim(radius) == 0:
+            r = radius
+            with self.lock.shared():
+                with nogil:
+                    ret = self.access.getAllAggregateAccessibilityVariables(
+                        r, cat, agg, dec, impno, eng)
 
-        return convert_vector_to_array_dbl(ret)
+            return convert_vector_to_array_dbl(ret)
+
+        radii = radius
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.getAllAggregateAccessibilityVariables(
+                    radii, cat, agg, dec, impno, eng)
+        if ret.size() == 0:
+            return np.full((radii.size(), self.numnodes), np.nan)
+
+        return convert_vector_to_array_dbl(ret).reshape(radii.size(), self.numnodes)
+
+    def get_aggregate_accessibility_variables(
+        self,
+        np.ndarray[long] srcnodes,
+        radius,
+        string category,
+        string aggtyp,
+        string decay,
+        int impno=0,
+        string engine=b"dijkstra",
+    ):
+        """
+        srcnodes - node ids of the sources to compute the aggregation for
+        radius - search radius, or a list of radii in which case a single
+            search at the largest radius is shared by all of them and a 2-D
+            array with a row per radius is returned
+        category - category name
+        aggtyp - aggregation type, see docs
+        decay - decay type, see docs
+        impno - the impedance id to use
+        engine - range query engine, see get_available_engines
+
+        Returns an array with the aggregation for each source node
+        """
+        cdef vector[long] srcs = srcnodes
+        cdef vector[float] radii
+        cdef vector[double] ret
+        cdef float r
+        if np.ndim(radius) == 0:
+            r = radius
+            with self.lock.shared():
+                with nogil:
+                    ret = self.access.getAggregateAccessibilityVariables(
+                        srcs, r, category, aggtyp, decay, impno, engine)
+
+            return convert_vector_to_array_dbl(ret)
+
+        radii = radius
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.getAggregateAccessibilityVariables(
+                    srcs, radii, category, aggtyp, decay, impno, engine)
+        if ret.size() == 0:
+            return np.full((radii.size(), srcs.size()), np.nan)
+
+        return convert_vector_to_array_dbl(ret).reshape(radii.size(), srcs.size())
+
+    def get_many_aggregate_accessibility_variables(
+        self,
+        double radius,
+        categories,
+        aggtyps,
+        decays,
+        int impno=0,
+        string engine=b"dijkstra",
+    ):
+        """
+        radius - search radius
+        categories - category names, one per aggregation
+        aggtyps - aggregation types, one per aggregation, see docs
+        decays - decay types, one per aggregation, see docs
+        impno - the impedance id to use
+        engine - range query engine, see get_available_engines
+
+        Returns a 2-D array with a row per aggregation and a column per node,
+        rows for aggregations which could not be computed are all nan
+        """
+        cdef vector[string] cats = categories, aggs = aggtyps, decs = decays
+        cdef vector[double] ret
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.getManyAggregateAccessibilityVariables(
+                    radius, cats, aggs, decs, impno, engine)
+
+        return convert_vector_to_array_dbl(ret).reshape(-1, self.numnodes)
 
     def shortest_path(self, int srcnode, int destnode, int impno=0):
         """
@@ -167,7 +459,11 @@ cdef class cyaccess:
         destnode - node id destination
         impno - the impedance id to use
         """
-        return self.access.Route(srcnode, destnode, impno)
+        cdef vector[int] ret
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.Route(srcnode, destnode, impno)
+        return ret
 
     def shortest_paths(self, np.ndarray[long] srcnodes, 
             np.ndarray[long] destnodes, int impno=0):
@@ -175,8 +471,17 @@ cdef class cyaccess:
         srcnodes - node ids of origins
         destnodes - node ids of destinations
         impno - impedance id
+
+        Returns the paths in CSR form, as arrays of offsets and nodes - the
+        nodes of path i are nodes[offsets[i]:offsets[i+1]]
         """
-        return self.access.Routes(srcnodes, destnodes, impno)
+        cdef vector[long] srcs = srcnodes, dsts = destnodes
+        cdef vector[long] offsets, nodes
+        with self.lock.shared():
+            with nogil:
+                self.access.Routes(srcs, dsts, impno, offsets, nodes)
+        return convert_vector_to_array_long(offsets), \
+            convert_vector_to_array_long(nodes)
 
     def shortest_path_distance(self, int srcnode, int destnode, int impno=0):
         """
@@ -184,7 +489,11 @@ cdef class cyaccess:
         destnode - node id destination
         impno - the impedance id to use
         """
-        return self.access.Distance(srcnode, destnode, impno)
+        cdef double ret
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.Distance(srcnode, destnode, impno)
+        return ret
 
     def shortest_path_distances(self, np.ndarray[long] srcnodes, 
             np.ndarray[long] destnodes, int impno=0):
@@ -193,17 +502,150 @@ cdef class cyaccess:
         destnodes - node ids of destinations
         impno - impedance id
         """
-        return self.access.Distances(srcnodes, destnodes, impno)
+        cdef vector[long] srcs = srcnodes, dsts = destnodes
+        cdef vector[double] ret
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.Distances(srcs, dsts, impno)
+        return convert_vector_to_array_dbl(ret)
     
-    def precompute_range(self, double radius):
-        self.access.precomputeRangeQueries(radius)
+    def shortest_path_distance_matrix(self, np.ndarray[long] srcnodes,
+            np.ndarray[long] destnodes, int impno=0):
+        """
+        srcnodes - node ids of origins
+        destnodes - node ids of destinations
+        impno - impedance id
+
+        Returns a float32 2D array with a row per origin and a column per
+        destination
+        """
+        cdef np.ndarray[float, ndim=2, mode="c"] arr = np.empty(
+            (len(srcnodes), len(destnodes)), dtype=np.float32)
+        cdef vector[long] srcs = srcnodes, dsts = destnodes
+        with self.lock.shared():
+            with nogil:
+                self.access.DistanceMatrix(srcs, dsts, <float *> arr.data,
+                                           impno)
+        return arr
+
+    def write_skim(self, string filename, np.ndarray[long] srcnodes,
+            np.ndarray[long] destnodes, int impno=0, int tile_size=1024,
+            double memory_mb=1024):
+        """
+        filename - the skim file to write, or to finish writing
+        srcnodes - node ids of origins
+        destnodes - node ids of destinations
+        impno - impedance id
+        tile_size - the number of origins and destinations in a tile
+        memory_mb - roughly the most memory to use, in megabytes
+        """
+        cdef vector[long] srcs = srcnodes, dsts = destnodes
+        with self.lock.shared():
+            with nogil:
+                self.access.writeSkim(srcs, dsts, filename, tile_size,
+                                      memory_mb, impno)
+
+    def initialize_target_set(self, string name, np.ndarray[long] node_ids):
+        """
+        name - the target set name
+        node_ids - node ids of the targets
+        """
+        cdef vector[long] nodes = node_ids
+        with self.lock.exclusive():
+            with nogil:
+                self.access.initializeTargetSet(name, nodes)
+
+    def shortest_path_distances_to_targets(self, np.ndarray[long] srcnodes,
+            string name, int impno=0):
+        """
+        srcnodes - node ids of origins
+        name - the target set name, see initialize_target_set
+        impno - impedance id
+
+        Returns a 2D array with a row per origin and a column per target
+        """
+        cdef vector[long] srcs = srcnodes
+        cdef vector[double] ret
+        with self.lock.shared():
+            with nogil:
+                ret = self.access.getDistancesToTargets(srcs, name, impno)
+        cdef long numrows = len(srcnodes)
+        cdef long numcols = ret.size() // numrows if numrows > 0 else 0
+        return convert_vector_to_array_dbl(ret).reshape(numrows, numcols)
+
+    def precompute_range(self, double radius, string engine=b"dijkstra"):
+        """
+        radius - the largest radius the precomputed queries will serve
+        engine - range query engine, see get_available_engines
+        """
+        with self.lock.exclusive():
+            with nogil:
+                self.access.precomputeRangeQueries(radius, engine)
+
+    def save_precomputed_range(self, string filename):
+        """
+        filename - the file to write the precomputed range queries to
+        """
+        with self.lock.shared():
+            with nogil:
+                self.access.saveRangeQueries(filename)
+
+    def load_precomputed_range(self, string filename):
+        """
+        filename - a file written by save_precomputed_range for this network
+        """
+        with self.lock.exclusive():
+            with nogil:
+                self.access.loadRangeQueries(filename)
+
+    def save_ch(self, string filename):
+        """
+        filename - the file to write the contraction hierarchies to
+        """
+        with self.lock.shared():
+            with nogil:
+                self.access.saveContractionHierarchies(filename)
+
+    def update_edge_weights(self, vector[long] edge_ids, vector[double] weights,
+                            int impno=0):
+        """
+        edge_ids - positions of the edges to change in the edges of the network
+        weights - the new weight of each of those edges
+        impno - impedance id
+        """
+        with self.lock.exclusive():
+            with nogil:
+                self.access.updateEdgeWeights(edge_ids, weights, impno)
+
+    def memory_usage(self, int impno):
+        """
+        impno - impedance id, or -1 for the parts shared by the impedances
+
+        Returns a dict of the bytes taken by each part of the graph
+        """
+        with self.lock.shared():
+            return self.access.memoryUsage(impno)
 
     def nodes_in_range(self, vector[long] srcnodes, float radius, int impno, 
-            np.ndarray[long] ext_ids):
+            np.ndarray[long] ext_ids, string engine=b"dijkstra"):
         """
         srcnodes - node ids of origins
         radius - maximum range in which to search for nearby nodes
         impno - the impedance id to use
         ext_ids - all node ids in the network
+        engine - range query engine, see get_available_engines
+
+        Returns the nodes in range of each origin in CSR form, as arrays of
+        offsets, node ids and distances - the nodes in range of origin i
+        are nodes[offsets[i]:offsets[i+1]], at the same entries of distances
         """
-        return self.access.Range(srcnodes, radius, impno, ext_ids)
+        cdef vector[long] ids = ext_ids
+        cdef vector[long] offsets, nodes
+        cdef vector[float] distances
+        with self.lock.shared():
+            with nogil:
+                self.access.Range(srcnodes, radius, impno, ids, engine,
+                                  offsets, nodes, distances)
+        return convert_vector_to_array_long(offsets), \
+            convert_vector_to_array_long(nodes), \
+            convert_vector_to_array_flt(distances)
@@ -1,51 +1,129 @@
 #include "graphalg.h"
 #include <math.h>
+#include <stdexcept>
 
 namespace MTC {
 namespace accessibility {
-Graphalg::Graphalg(
-        int numnodes, vector< vector<long> > edges, vector<double> edgeweights,
+
+void hashBytes(uint64_t &hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0 ; i < size ; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+}
+
+
+// the fingerprint of the CH::Edges of a graph, with their weights as the
+// contraction hierarchies have them - so the same whether the graph was
+// built with these weights or updated to them
+template <class EdgesT>
+static uint64_t fingerprintEdges(int numnodes, const EdgesT &edges,
+                                 bool twoway) {
+    uint64_t fingerprint = FNV_OFFSET;
+    hashBytes(fingerprint, &numnodes, sizeof(numnodes));
+    hashBytes(fingerprint, &twoway, sizeof(twoway));
+    for (size_t i = 0 ; i < edges.size() ; i++) {
+        CH::Edge edge = edges[i];
+        NodeID e[2] = {edge.source(), edge.target()};
+        EdgeWeight weight = edge.weight();
+        hashBytes(fingerprint, e, sizeof(e));
+        hashBytes(fingerprint, &weight, sizeof(weight));
+    }
+    return fingerprint;
+}
+
+
+uint64_t Graphalg::computeFingerprint(
+        int numnodes, const EdgeArray &edges, const double *edgeweights,
         bool twoway) {
+    return fingerprintEdges(numnodes, CHEdgeArray(edges, edgeweights, twoway),
+                            twoway);
+}
+
+
+std::shared_ptr<const CH::EdgeTopology> Graphalg::buildEdgeTopology(
+        int numnodes, const EdgeArray &edges, bool twoway) {
+    return std::shared_ptr<const CH::EdgeTopology>(
+        new CH::EdgeTopology(numnodes, CHEdgeArray(edges, NULL, twoway)));
+}
+
+
+std::shared_ptr<const CH::CCHTopology> Graphalg::buildCCHTopology(
+        int numnodes, const EdgeArray &edges) {
+    FILE_LOG(logINFO) << "Ordering customizable contraction hierarchies\n";
+
+    return std::shared_ptr<const CH::CCHTopology>(
+        new CH::CCHTopology(numnodes, CHEdgeArray(edges, NULL, true)));
+}
+
+
+Graphalg::Graphalg(
+        int numnodes, const EdgeArray &edges, const double *edgeweights,
+        bool twoway, std::shared_ptr<const CH::EdgeTopology> topology,
+        std::shared_ptr<const CH::CCHTopology> cch,
+        char *chData, size_t chSize) {
     this->numnodes = numnodes;
+    this->twoway = twoway;
+    fingerprint = computeFingerprint(numnodes, edges, edgeweights, twoway);
 
-    int num = omp_get_max_threads();
-    
     FILE_LOG(logINFO) << "Generating contraction hierarchies with "
-                      << num << " threads.\n";
-    
-    ch = CH::ContractionHierarchies(num);
+                      << omp_get_max_threads() << " threads.\n";
 
-    vector<CH::Node> nv;
+    FILE_LOG(logINFO) << "Setting CH node vector of size "
+                      << numnodes << "\n";
+
+    // CH only counts the nodes, so there's no need for a node vector
+    ch.SetNumberOfNodes(numnodes);
 
-    for (int i = 0 ; i < numnodes ; i++) {
-        // CH allows you to pass in a node id, and an x and a y, and then
-        // never uses it - to be clear, we don't pass it in anymore
-        CH::Node n(i, 0, 0);
-        nv.push_back(n);
+    if (!topology) {
+        topology = buildEdgeTopology(numnodes, edges, twoway);
     }
 
-    FILE_LOG(logINFO) << "Setting CH node vector of size "
-                      << nv.size() << "\n";
-	
-    ch.SetNodeVector(nv);
+    vector<EdgeWeight> weights(edges.size());
+    for (size_t i = 0 ; i < edges.size() ; i++) {
+        weights[i] = edgeweights[i]*DISTANCEMULTFACT;
+    }
+
+    FILE_LOG(logINFO) << "Setting CH edge vector of size "
+                      << weights.size() << "\n";
 
-    vector<CH::Edge> ev;
+    ch.SetEdgeVector(topology, weights);
+    numedges = weights.size();
 
-    for (int i = 0 ; i < edges.size() ; i++) {
-        CH::Edge e(edges[i][0], edges[i][1], i,
-            edgeweights[i]*DISTANCEMULTFACT, true, twoway);
-        ev.push_back(e);
+    if (chData) {
+        FILE_LOG(logINFO) << "Using saved contraction hierarchies\n";
+        ch.ReadGraphs(chData, chSize);
+    } else if (cch) {
+        ch.RunCustomization(cch);
+    } else {
+        ch.RunPreprocessing();
     }
+}
 
-    FILE_LOG(logINFO) << "Setting CH edge vector of size "
-                      << ev.size() << "\n";
-    
-    ch.SetEdgeVector(ev);
-    ch.RunPreprocessing();
+
+void Graphalg::updateEdgeWeights(const vector<long> &edgeIds,
+                                 const vector<double> &edgeweights,
+                                 std::shared_ptr<const CH::CCHTopology> cch) {
+    vector<unsigned> ids(edgeIds.size());
+    vector<EdgeWeight> weights(edgeIds.size());
+    for (int i = 0 ; i < edgeIds.size() ; i++) {
+        if (edgeIds[i] < 0 || edgeIds[i] >= numedges) {
+            throw std::runtime_error("edge out of range");
+        }
+        ids[i] = edgeIds[i];
+        weights[i] = edgeweights[i]*DISTANCEMULTFACT;
+    }
+
+    FILE_LOG(logINFO) << "Updating the weights of " << ids.size()
+                      << " edges\n";
+
+    ch.UpdateEdgeWeights(ids, weights, cch);
+    fingerprint = fingerprintEdges(numnodes, ch.GetInputEdges(), twoway);
 }
 
 
-std::vector<NodeID> Graphalg::Route(int src, int tgt, int threadNum) {
+std::vector<NodeID> Graphalg::Route(int src, int tgt) {
     std::vector<NodeID> ResultingPath;
 
     CH::Node src_node(src, 0, 0);
@@ -54,28 +132,48 @@ std::vector<NodeID> Graphalg::Route(int src, int tgt, int threadNum) {
     ch.computeShortestPath(
         src_node,
         tgt_node,
-        ResultingPath,
-        threadNum);
+        ResultingPath);
 
     return ResultingPath;
 }
 
 
-double Graphalg::Distance(int src, int tgt, int threadNum) {
+double Graphalg::Distance(int src, int tgt) {
     CH::Node src_node(src, 0, 0);
     CH::Node tgt_node(tgt, 0, 0);
 
     unsigned int length = ch.computeLengthofShortestPath(
         src_node,
-        tgt_node,
-        threadNum);
+        tgt_node);
 
     return static_cast<double>(length) / static_cast<double>(DISTANCEMULTFACT);
 }
 
 
-void Graphalg::Range(int src, double maxdist, int threadNum,
-                     DistanceVec &ResultingNodes) {
+void Graphalg::Routes(int src, const std::vector<NodeID> &tgts,
+                      std::vector<std::vector<NodeID> > &ResultingPaths) {
+    CH::Node src_node(src, 0, 0);
+
+    ch.computeShortestPaths(src_node, tgts, ResultingPaths);
+}
+
+
+void Graphalg::Distances(int src, const std::vector<NodeID> &tgts,
+                         std::vector<double> &ResultingDistances) {
+    CH::Node src_node(src, 0, 0);
+
+    std::vector<unsigned> tmp;
+    ch.computeLengthsofShortestPaths(src_node, tgts, tmp);
+
+    ResultingDistances.resize(tmp.size());
+    for (int i = 0 ; i < tmp.size() ; i++) {
+        ResultingDistances[i] =
+            static_cast<double>(tmp[i]) / static_cast<double>(DISTANCEMULTFACT);
+    }
+}
+
+
+void Graphalg::Range(int src, double maxdist, DistanceVec &ResultingNodes) {
     CH::Node src_node(src, 0, 0);
 
     std::vector<std::pair<NodeID, unsigned> > tmp;
@@ -83,8 +181,7 @@ void Graphalg::Range(int src, double maxdist, int threadNum,
     ch.computeReachableNodesWithin(
         src_node,
         maxdist*DISTANCEMULTFACT,
-        tmp,
-        threadNum);
+        tmp);
 
     for (int i = 0 ; i < tmp.size() ; i++) {
         std::pair<NodeID, float> node;
@@ -95,9 +192,114 @@ void Graphalg::Range(int src, double maxdist, int threadNum,
 }
 
 
+void Graphalg::Range(int src, double maxdist,
+                     std::vector<NodeID> &ResultingNodes,
+                     std::vector<float> &ResultingDistances) {
+    CH::Node src_node(src, 0, 0);
+
+    std::vector<std::pair<NodeID, unsigned> > tmp;
+
+    ch.computeReachableNodesWithin(
+        src_node,
+        maxdist*DISTANCEMULTFACT,
+        tmp);
+
+    for (int i = 0 ; i < tmp.size() ; i++) {
+        ResultingNodes.push_back(tmp[i].first);
+        ResultingDistances.push_back(tmp[i].second/DISTANCEMULTFACT);
+    }
+}
+
+
+void Graphalg::RangePHAST(const std::vector<NodeID> &srcs, double maxdist,
+                          std::vector<std::vector<NodeID> > &ResultingNodes,
+                          std::vector<std::vector<float> > &ResultingDistances) {
+    std::vector<CH::ReachedNode> tmp;
+
+    ch.computeReachableNodesWithinPHAST(
+        srcs,
+        maxdist*DISTANCEMULTFACT,
+        tmp);
+
+    ResultingNodes.resize(srcs.size());
+    ResultingDistances.resize(srcs.size());
+    for (int j = 0 ; j < srcs.size() ; j++) {
+        ResultingNodes[j].clear();
+        ResultingDistances[j].clear();
+        for (int i = 0 ; i < tmp[j].size() ; i++) {
+            ResultingNodes[j].push_back(tmp[j][i].first);
+            ResultingDistances[j].push_back(tmp[j][i].second/DISTANCEMULTFACT);
+        }
+    }
+}
+
+
+void Graphalg::ReverseRange(int tgt, double maxdist,
+                            std::vector<NodeID> &ResultingNodes,
+                            std::vector<float> &ResultingDistances) {
+    CH::Node tgt_node(tgt, 0, 0);
+
+    std::vector<std::pair<NodeID, unsigned> > tmp;
+
+    ch.computeNodesReachingWithin(
+        tgt_node,
+        maxdist*DISTANCEMULTFACT,
+        tmp);
+
+    for (int i = 0 ; i < tmp.size() ; i++) {
+        ResultingNodes.push_back(tmp[i].first);
+        ResultingDistances.push_back(tmp[i].second/DISTANCEMULTFACT);
+    }
+}
+
+
+void Graphalg::DistancesToTargets(
+        const POIKeyType &name, const std::vector<NodeID> &srcs,
+        double *ResultingDistances) {
+    std::vector<std::vector<EdgeWeight> > tmp;
+
+    ch.computeDistancesToTargets(name, srcs, tmp);
+
+    for (int j = 0 ; j < tmp.size() ; j++) {
+        for (int i = 0 ; i < tmp[j].size() ; i++) {
+            *ResultingDistances++ = tmp[j][i]/DISTANCEMULTFACT;
+        }
+    }
+}
+
+
+void Graphalg::BackwardSearchSpace(int tgt,
+                                   std::vector<CH::BucketEntry> &SearchSpace) {
+    ch.computeBackwardSearchSpace(tgt, SearchSpace);
+}
+
+
+void Graphalg::DistancesFromBuckets(int src,
+                                    const CH::ManyToManyBuckets &buckets,
+                                    std::vector<EdgeWeight> &scratch,
+                                    float *row) {
+    scratch.resize(buckets.numberOfTargets);
+    DistancesFromBuckets(src, buckets, scratch.data());
+    for (int i = 0 ; i < scratch.size() ; i++) {
+        row[i] = scratch[i]/DISTANCEMULTFACT;
+    }
+}
+
+
+void Graphalg::DistancesFromSearchSpace(
+        const std::vector<CH::BucketEntry> &SearchSpace,
+        const CH::ManyToManyBuckets &buckets, int firstTarget,
+        std::vector<EdgeWeight> &scratch, float *row) {
+    scratch.resize(buckets.numberOfTargets);
+    buckets.Scan(SearchSpace, scratch.data(), firstTarget);
+    for (int i = firstTarget ; i < scratch.size() ; i++) {
+        row[i] = scratch[i]/DISTANCEMULTFACT;
+    }
+}
+
+
 DistanceMap
-Graphalg::NearestPOI(const POIKeyType &category, int src, double maxdist, int number,
-                     int threadNum) {
+Graphalg::NearestPOI(const POIKeyType &category, int src, double maxdist, int number) {
     DistanceMap dm;
 
     std::vector<CH::BucketEntry> ResultingNodes;
@@ -106,8 +308,7 @@ Graphalg::NearestPOI(const POIKeyType &category, int src, double maxdist, int nu
         src,
         maxdist*DISTANCEMULTFACT,
         number,
-        ResultingNodes,
-        threadNum);
+        ResultingNodes);
 
     for (int i = 0 ; i < ResultingNodes.size() ; i++) {
         dm[ResultingNodes[i].node] =
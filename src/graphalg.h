@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdint.h>
+#include <memory>
+#include <string>
 #include <vector>
 #include <map>
 #include <utility>
@@ -15,25 +18,185 @@ namespace accessibility {
 
 using std::vector;
 
+// FNV-1a, which is plenty to tell graphs and files apart - hash starts
+// at FNV_OFFSET
+#define FNV_OFFSET 14695981039346656037ULL
+void hashBytes(uint64_t &hash, const void *data, size_t size);
+
+// the edges of a network, read in place from numedges rows of (from, to)
+// node indexes in an array owned by the caller
+class EdgeArray {
+ public:
+    EdgeArray(const long *nodes, size_t numedges)
+        : nodes(nodes), numedges(numedges) {}
+    size_t size() const { return numedges; }
+    long from(size_t i) const { return nodes[2*i]; }
+    long to(size_t i) const { return nodes[2*i+1]; }
+
+ private:
+    const long *nodes;
+    size_t numedges;
+};
+
+// the edges as the CH::Edges the contraction hierarchies are built from,
+// made one at a time rather than copied - the weights are 0 if there
+// are none
+class CHEdgeArray {
+ public:
+    typedef CH::Edge value_type;
+    CHEdgeArray(const EdgeArray &edges, const double *edgeweights,
+                bool twoway)
+        : edges(edges), edgeweights(edgeweights), twoway(twoway) {}
+    size_t size() const { return edges.size(); }
+    CH::Edge operator[](size_t i) const {
+        return CH::Edge(edges.from(i), edges.to(i), i,
+                        edgeweights ? edgeweights[i]*DISTANCEMULTFACT : 0,
+                        true, twoway);
+    }
+
+ private:
+    const EdgeArray &edges;
+    const double *edgeweights;
+    bool twoway;
+};
+
 typedef std::map<int, float> DistanceMap;
 typedef std::vector<std::pair<NodeID, float> > DistanceVec;
 
+// the contraction hierarchies are built from the edges, which are kept as
+// topology (built from the edges if it isn't given, and otherwise shared
+// with the other graphs of the network) and the weights of this graph - by
+// contracting them, or by customizing cch if it is given, which is a customizable
+// contraction hierarchy built from the same edges and shared between the
+// graphs of a network - unless chData holds the graphs saved from an
+// earlier build on the same edges (see
+// CH::ContractionHierarchies::ReadGraphs), in which case they're used in
+// place and chData must outlive the Graphalg.  queries can be run from
+// any number of threads at once, each borrowing the scratch space it needs
+// from pools in the contraction hierarchies, but not while the graph is
+// changed by updateEdgeWeights, addPOIToIndex, initPOIIndex or
+// initTargetSet
 class Graphalg {
  public:
     Graphalg(
-        int numnodes,
-        vector< vector<long> > edges, vector<double> edgeweights,
+        int numnodes, const EdgeArray &edges, const double *edgeweights,
+        bool twoway,
+        std::shared_ptr<const CH::EdgeTopology> topology =
+            std::shared_ptr<const CH::EdgeTopology>(),
+        std::shared_ptr<const CH::CCHTopology> cch =
+            std::shared_ptr<const CH::CCHTopology>(),
+        char *chData = NULL, size_t chSize = 0);
+
+    // the edges without their weights, for the constructor of each of the
+    // graphs sharing them
+    static std::shared_ptr<const CH::EdgeTopology> buildEdgeTopology(
+        int numnodes, const EdgeArray &edges, bool twoway);
+
+    // the topology of a customizable contraction hierarchy on the edges,
+    // for the constructor of each of the graphs sharing them
+    static std::shared_ptr<const CH::CCHTopology> buildCCHTopology(
+        int numnodes, const EdgeArray &edges);
+
+    // see fingerprint below
+    static uint64_t computeFingerprint(
+        int numnodes, const EdgeArray &edges, const double *edgeweights,
         bool twoway);
 
-    std::vector<NodeID> Route(int src, int tgt, int threadNum = 0);
+    // give the edges edgeIds (positions in the edges of the constructor)
+    // new weights, and customize the contraction hierarchies again for them
+    // on cch, which must have been built from the same edges - after the
+    // first update only the part of the hierarchy above the changed edges
+    // is done again (see CH::CCHMetric::Update).  the POI indexes and target
+    // sets are kept up to date.  throws std::runtime_error if an edge is
+    // out of range
+    void updateEdgeWeights(const vector<long> &edgeIds,
+                           const vector<double> &edgeweights,
+                           std::shared_ptr<const CH::CCHTopology> cch);
+
+    // the bytes taken by each part of the graph which isn't shared with the
+    // other graphs of the network
+    std::map<std::string, size_t> memoryUsage() const {
+        std::map<std::string, size_t> usage;
+        ch.getMemoryUsage(usage);
+        return usage;
+    }
+
+    std::vector<NodeID> Route(int src, int tgt);
+
+    double Distance(int src, int tgt);
+
+    // the shortest paths and their lengths from src to each of tgts, which
+    // share a single forward search
+    void Routes(int src, const std::vector<NodeID> &tgts,
+                std::vector<std::vector<NodeID> > &ResultingPaths);
 
-    double Distance(int src, int tgt, int threadNum = 0);
+    void Distances(int src, const std::vector<NodeID> &tgts,
+                   std::vector<double> &ResultingDistances);
 
-    void Range(int src, double maxdist, int threadNum,
-               DistanceVec &ResultingNodes);
+    void Range(int src, double maxdist, DistanceVec &ResultingNodes);
+
+    // same as above, but with the nodes and distances in separate vectors
+    void Range(int src, double maxdist,
+               std::vector<NodeID> &ResultingNodes,
+               std::vector<float> &ResultingDistances);
+
+    // the range queries from up to PHAST_BATCH sources at once, with a
+    // sweep over the whole contracted graph rather than a search
+    void RangePHAST(const std::vector<NodeID> &srcs, double maxdist,
+                    std::vector<std::vector<NodeID> > &ResultingNodes,
+                    std::vector<std::vector<float> > &ResultingDistances);
+
+    // the nodes from which tgt can be reached within maxdist, i.e. a range
+    // query on the reversed graph
+    void ReverseRange(int tgt, double maxdist,
+                      std::vector<NodeID> &ResultingNodes,
+                      std::vector<float> &ResultingDistances);
+
+    // the distances from up to PHAST_BATCH sources at once to every target
+    // of the set name, from an RPHAST sweep - a row of TargetSetSize(name)
+    // distances per source is written to ResultingDistances, with
+    // unreachable targets at UINT_MAX / DISTANCEMULTFACT like Distance
+    void DistancesToTargets(const POIKeyType &name,
+                            const std::vector<NodeID> &srcs,
+                            double *ResultingDistances);
+
+    // the number of targets in the set name, -1 if there is no such set
+    int TargetSetSize(const POIKeyType &name) const {
+        return ch.getTargetSetSize(name);
+    }
+
+    void initTargetSet(const POIKeyType &name,
+                       const std::vector<NodeID> &targets) {
+        ch.createTargetSet(name, targets);
+    }
+
+    // the two halves of a many-to-many query - the backward search from a
+    // target gives the bucket entries of that target, and once the buckets
+    // of all the targets are built the forward search from a source fills
+    // in row with its distance to every target.  scratch is reused between
+    // calls by the same thread
+    void BackwardSearchSpace(int tgt,
+                             std::vector<CH::BucketEntry> &SearchSpace);
+
+    void DistancesFromBuckets(int src, const CH::ManyToManyBuckets &buckets,
+                              std::vector<EdgeWeight> &scratch, float *row);
+
+    // same as above, but in the units of the contraction hierarchy
+    void DistancesFromBuckets(int src, const CH::ManyToManyBuckets &buckets,
+                              EdgeWeight *row) {
+        ch.computeDistancesFromBuckets(src, buckets, row);
+    }
+
+    // on a twoway graph, the distances to the targets from firstTarget on
+    // from the node whose backward search space is SearchSpace - this needs
+    // no search, see CH::ManyToManyBuckets::Scan
+    void DistancesFromSearchSpace(
+            const std::vector<CH::BucketEntry> &SearchSpace,
+            const CH::ManyToManyBuckets &buckets, int firstTarget,
+            std::vector<EdgeWeight> &scratch, float *row);
 
     DistanceMap NearestPOI(const POIKeyType &category, int src, double maxdist,
-                           int number, int threadNum = 0);
+                           int number);
 
     void addPOIToIndex(const POIKeyType &category, int i) {
         ch.addPOIToIndex(category, i);
@@ -44,6 +207,19 @@ class Graphalg {
     }
 
     int numnodes;
+
+    int numedges;
+
+    // whether every edge goes both ways with the same weight, so that
+    // distances are symmetric
+    bool twoway;
+
+    // a hash of the nodes, edges and weights of the graph, used to check
+    // that results stored on disk belong to this graph - it's computed
+    // again when the weights are updated, so it's the same as that of a
+    // graph built with the new weights
+    uint64_t fingerprint;
+
     CH::ContractionHierarchies ch;
 };
 }  // namespace accessibility
@@ -0,0 +1,61 @@
+#include "mappedfile.h"
+#include <fstream>
+#include <stdexcept>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace MTC {
+namespace accessibility {
+
+MappedFile::MappedFile(const std::string &filename, bool writable)
+    : ptr(NULL), len(0), mapped(false) {
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Unable to open " + filename);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Unable to read " + filename);
+    }
+    len = st.st_size;
+
+    if (len > 0) {
+        void *p = writable ?
+            mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) :
+            mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            ptr = static_cast<char *>(p);
+            mapped = true;
+        }
+    }
+    close(fd);
+    if (mapped || len == 0) return;
+#endif
+    // no memory mapping available - read the whole thing
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Unable to open " + filename);
+    in.seekg(0, std::ios::end);
+    len = in.tellg();
+    in.seekg(0, std::ios::beg);
+    buffer.resize(len);
+    if (len > 0 && !in.read(&buffer[0], len))
+        throw std::runtime_error("Unable to read " + filename);
+    ptr = buffer.data();
+}
+
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+    if (mapped)
+        munmap(ptr, len);
+#endif
+}
+}  // namespace accessibility
+}  // namespace MTC
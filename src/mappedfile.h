@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "shared.h"
+
+namespace MTC {
+namespace accessibility {
+
+// a read-only view of a whole file - the file is memory mapped where the
+// platform supports it, so that many processes loading the same file
+// share one copy of it through the page cache, and read into memory
+// otherwise.  a writable view is mapped copy-on-write, so the pages which
+// are written to become private to the process and the file is never
+// changed
+class MappedFile {
+ public:
+    // throws std::runtime_error if the file can't be opened
+    explicit MappedFile(const std::string &filename, bool writable = false);
+    ~MappedFile();
+
+    const char *data() const { return ptr; }
+    size_t size() const { return len; }
+
+    // only to be written to if the view is writable
+    char *mutableData() { return ptr; }
+
+ private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    char *ptr;
+    size_t len;
+    bool mapped;
+    std::vector<char> buffer;
+};
+}  // namespace accessibility
+}  // namespace MTC
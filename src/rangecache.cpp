@@ -0,0 +1,275 @@
+#include "rangecache.h"
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace MTC {
+namespace accessibility {
+
+// the number of source nodes whose results are held in scratch buffers
+// at once while building the cache
+#define RANGE_CACHE_BLOCK 65536
+
+// the layout of a saved cache is the header, then a RangeCacheGraph for
+// each graph, then the offsets, nodes and distances arrays of each graph
+// in turn, each padded to a multiple of 8 bytes so that all the arrays
+// are aligned when the file is mapped
+#define RANGE_CACHE_MAGIC "PNDRNGC"
+#define RANGE_CACHE_VERSION 1
+
+struct RangeCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numgraphs;
+    uint64_t numnodes;
+    float radius;
+    uint32_t reserved;
+};
+
+struct RangeCacheGraph {
+    uint64_t fingerprint;
+    uint64_t numentries;
+};
+
+
+static uint64_t padded(uint64_t size) {
+    return (size + 7) / 8 * 8;
+}
+
+
+static void writeArray(std::ofstream &out, const void *data, uint64_t size) {
+    static const char zeros[8] = {0};
+    out.write(static_cast<const char *>(data), size);
+    out.write(zeros, padded(size) - size);
+}
+
+
+// the range queries from sources first to last-1 into block, a sweep of
+// PHAST_BATCH sources at a time
+static void rangePHAST(Graphalg &g, int first, int last, float radius,
+                       vector<RangeBuffer> &block) {
+    int numbatches = (last - first + PHAST_BATCH - 1) / PHAST_BATCH;
+
+    #pragma omp parallel
+    {
+    vector<NodeID> batch;
+    vector<vector<NodeID> > nodes;
+    vector<vector<float> > distances;
+    #pragma omp for schedule(guided)
+    for (int b = 0 ; b < numbatches ; b++) {
+        int start = first + b * PHAST_BATCH;
+        int end = std::min(last, start + PHAST_BATCH);
+        batch.clear();
+        for (int i = start ; i < end ; i++) {
+            batch.push_back(i);
+        }
+        g.RangePHAST(batch, radius, nodes, distances);
+        for (int i = start ; i < end ; i++) {
+            block[i - first].nodes.swap(nodes[i - start]);
+            block[i - first].distances.swap(distances[i - start]);
+        }
+    }
+    }
+}
+
+
+RangeCache::RangeCache()
+    : radius(-1), offsets(NULL), nodes(NULL), distances(NULL), numnodes(0) {}
+
+
+RangeCache::RangeCache(const RangeCache &other) {
+    *this = other;
+}
+
+
+RangeCache &RangeCache::operator=(const RangeCache &other) {
+    radius = other.radius;
+    offsets = other.offsets;
+    nodes = other.nodes;
+    distances = other.distances;
+    numnodes = other.numnodes;
+    offsetsStorage = other.offsetsStorage;
+    nodesStorage = other.nodesStorage;
+    distancesStorage = other.distancesStorage;
+    file = other.file;
+    // owned arrays have moved so the pointers have to follow them
+    if (!file && !offsetsStorage.empty()) useStorage();
+    return *this;
+}
+
+
+void RangeCache::useStorage() {
+    offsets = offsetsStorage.data();
+    nodes = nodesStorage.data();
+    distances = distancesStorage.data();
+}
+
+
+void RangeCache::build(Graphalg &g, int numnodes, float radius,
+                       bool phast) {
+    file.reset();
+    offsetsStorage.assign(numnodes + 1, 0);
+    nodesStorage.clear();
+    distancesStorage.clear();
+
+    vector<RangeBuffer> block(std::min(numnodes, RANGE_CACHE_BLOCK));
+
+    // the range queries are run a block of sources at a time - the first
+    // pass runs the queries in parallel, then the results are appended
+    // after their offsets are known and the second pass copies them into
+    // place in parallel
+    for (int first = 0 ; first < numnodes ; first += RANGE_CACHE_BLOCK) {
+        int last = std::min(numnodes, first + RANGE_CACHE_BLOCK);
+
+        if (phast) {
+            rangePHAST(g, first, last, radius, block);
+        } else {
+            #pragma omp parallel for schedule(guided)
+            for (int i = first ; i < last ; i++) {
+                RangeBuffer &buf = block[i - first];
+                buf.nodes.clear();
+                buf.distances.clear();
+                g.Range(i, radius, buf.nodes, buf.distances);
+            }
+        }
+
+        for (int i = first ; i < last ; i++) {
+            offsetsStorage[i+1] = offsetsStorage[i] +
+                block[i - first].nodes.size();
+        }
+
+        // after the first block we can guess the size of the whole thing
+        if (first == 0) {
+            uint64_t guess = static_cast<double>(offsetsStorage[last]) /
+                last * numnodes;
+            nodesStorage.reserve(guess);
+            distancesStorage.reserve(guess);
+        }
+        nodesStorage.resize(offsetsStorage[last]);
+        distancesStorage.resize(offsetsStorage[last]);
+
+        #pragma omp parallel for schedule(guided)
+        for (int i = first ; i < last ; i++) {
+            RangeBuffer &buf = block[i - first];
+            std::copy(buf.nodes.begin(), buf.nodes.end(),
+                      nodesStorage.begin() + offsetsStorage[i]);
+            std::copy(buf.distances.begin(), buf.distances.end(),
+                      distancesStorage.begin() + offsetsStorage[i]);
+        }
+    }
+
+    this->numnodes = numnodes;
+    this->radius = radius;
+    useStorage();
+}
+
+
+void RangeCache::save(const std::string &filename,
+                      const vector<RangeCache> &caches,
+                      const vector<uint64_t> &fingerprints, int numnodes) {
+    if (caches.empty() || caches[0].empty()) {
+        throw std::runtime_error("no range queries have been precomputed");
+    }
+
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    if (!out) {
+        throw std::runtime_error("Unable to open " + filename +
+                                 " for writing");
+    }
+
+    RangeCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RANGE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = RANGE_CACHE_VERSION;
+    header.numgraphs = caches.size();
+    header.numnodes = numnodes;
+    header.radius = caches[0].radius;
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    for (int i = 0 ; i < caches.size() ; i++) {
+        RangeCacheGraph graph = {fingerprints[i],
+                                 caches[i].offsets[numnodes]};
+        out.write(reinterpret_cast<const char *>(&graph), sizeof(graph));
+    }
+
+    for (int i = 0 ; i < caches.size() ; i++) {
+        const RangeCache &c = caches[i];
+        uint64_t numentries = c.offsets[numnodes];
+        writeArray(out, c.offsets, (numnodes + 1) * sizeof(uint64_t));
+        writeArray(out, c.nodes, numentries * sizeof(NodeID));
+        writeArray(out, c.distances, numentries * sizeof(float));
+    }
+
+    if (!out) {
+        throw std::runtime_error("error writing " + filename);
+    }
+}
+
+
+void RangeCache::load(const std::string &filename,
+                      vector<RangeCache> &caches,
+                      const vector<uint64_t> &fingerprints, int numnodes) {
+    std::shared_ptr<MappedFile> file(new MappedFile(filename));
+    const char *data = file->data();
+    uint64_t size = file->size();
+
+    RangeCacheHeader header;
+    if (size < sizeof(header)) {
+        throw std::runtime_error(filename + " is not a range query file");
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, RANGE_CACHE_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(filename + " is not a range query file");
+    }
+    if (header.version != RANGE_CACHE_VERSION) {
+        throw std::runtime_error(filename +
+                                 " was written by an unsupported version");
+    }
+    if (header.numnodes != numnodes ||
+        header.numgraphs != fingerprints.size()) {
+        throw std::runtime_error(filename +
+                                 " was computed on a different network");
+    }
+
+    const RangeCacheGraph *graphs =
+        reinterpret_cast<const RangeCacheGraph *>(data + sizeof(header));
+    uint64_t pos = sizeof(header) + header.numgraphs * sizeof(RangeCacheGraph);
+    if (size < pos) {
+        throw std::runtime_error(filename + " is truncated");
+    }
+
+    vector<RangeCache> loaded(header.numgraphs);
+    for (int i = 0 ; i < header.numgraphs ; i++) {
+        if (graphs[i].fingerprint != fingerprints[i]) {
+            throw std::runtime_error(filename +
+                                     " was computed on a different network");
+        }
+        uint64_t numentries = graphs[i].numentries;
+        uint64_t offsetsSize = padded((numnodes + 1) * sizeof(uint64_t));
+        uint64_t nodesSize = padded(numentries * sizeof(NodeID));
+        uint64_t distancesSize = padded(numentries * sizeof(float));
+        if (size < pos + offsetsSize + nodesSize + distancesSize) {
+            throw std::runtime_error(filename + " is truncated");
+        }
+
+        RangeCache &c = loaded[i];
+        c.offsets = reinterpret_cast<const uint64_t *>(data + pos);
+        pos += offsetsSize;
+        c.nodes = reinterpret_cast<const NodeID *>(data + pos);
+        pos += nodesSize;
+        c.distances = reinterpret_cast<const float *>(data + pos);
+        pos += distancesSize;
+
+        if (c.offsets[numnodes] != numentries) {
+            throw std::runtime_error(filename + " is corrupt");
+        }
+        c.numnodes = numnodes;
+        c.radius = header.radius;
+        c.file = file;
+    }
+
+    caches.swap(loaded);
+}
+}  // namespace accessibility
+}  // namespace MTC
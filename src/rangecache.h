@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shared.h"
+#include "graphalg.h"
+#include "mappedfile.h"
+
+namespace MTC {
+namespace accessibility {
+
+using std::vector;
+
+// the nodes reached by a range query from a single source node, in the
+// order they were settled - i.e. sorted by distance
+struct RangeResult {
+    const NodeID *nodes;
+    const float *distances;
+    int size;
+};
+
+// scratch storage for a range query which is not served from a cache
+struct RangeBuffer {
+    vector<NodeID> nodes;
+    vector<float> distances;
+
+    RangeResult result() const {
+        RangeResult r = {nodes.data(), distances.data(),
+                         static_cast<int>(nodes.size())};
+        return r;
+    }
+};
+
+// the results of a range query from every node of a graph, stored in
+// compressed sparse row format - the nodes reached from node i are
+// nodes[offsets[i]] to nodes[offsets[i+1]-1] and their distances are in
+// the same positions of distances.  the arrays are either owned by the
+// cache or live in a memory mapped file written by save
+class RangeCache {
+ public:
+    RangeCache();
+    RangeCache(const RangeCache &other);
+    RangeCache &operator=(const RangeCache &other);
+
+    // run the range query from every node of the graph and store it - with
+    // phast set the queries are PHAST sweeps instead of searches
+    void build(Graphalg &g, int numnodes, float radius, bool phast = false);
+
+    // write the caches of all the graphs of a network to a file along with
+    // the fingerprints of the graphs - all caches must share one radius
+    static void save(const std::string &filename,
+                     const vector<RangeCache> &caches,
+                     const vector<uint64_t> &fingerprints, int numnodes);
+
+    // map the caches saved by save back in, throwing std::runtime_error if
+    // the file isn't a range cache for graphs with these fingerprints
+    static void load(const std::string &filename, vector<RangeCache> &caches,
+                     const vector<uint64_t> &fingerprints, int numnodes);
+
+    RangeResult get(int srcnode) const {
+        RangeResult r = {nodes + offsets[srcnode],
+                         distances + offsets[srcnode],
+                         static_cast<int>(offsets[srcnode+1] -
+                                          offsets[srcnode])};
+        return r;
+    }
+
+    bool empty() const { return offsets == NULL; }
+
+    float radius;
+
+ private:
+    void useStorage();
+
+    const uint64_t *offsets;
+    const NodeID *nodes;
+    const float *distances;
+    int numnodes;
+
+    vector<uint64_t> offsetsStorage;
+    vector<NodeID> nodesStorage;
+    vector<float> distancesStorage;
+    std::shared_ptr<MappedFile> file;
+};
+}  // namespace accessibility
+}  // namespace MTC
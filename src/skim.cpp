@@ -0,0 +1,259 @@
+#include "skim.h"
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include "graphalg.h"
+
+namespace MTC {
+namespace accessibility {
+
+#define SKIM_MAGIC "PNDSKIM"
+#define SKIM_VERSION 1
+
+struct SkimHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t tileRows;
+    uint32_t tileCols;
+    uint32_t reserved;
+    uint64_t numrows;
+    uint64_t numcols;
+    uint64_t fingerprint;
+};
+
+struct SkimTileHeader {
+    uint32_t rowTile;
+    uint32_t colTile;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+
+static uint64_t checksum(const char *data, uint64_t size) {
+    uint64_t hash = FNV_OFFSET;
+    hashBytes(hash, data, size);
+    return hash;
+}
+
+
+// the origins and destinations are stored after the header as int64
+static uint64_t tilesStart(const SkimLayout &layout) {
+    return sizeof(SkimHeader) +
+        (layout.numrows + layout.numcols) * sizeof(int64_t);
+}
+
+
+// the position of each valid tile record in the skim in data, up to the
+// first which is cut short or corrupt - returns where that record starts,
+// which is where the next tile is to be written
+static uint64_t scanTiles(const char *data, uint64_t size,
+                          const SkimLayout &layout,
+                          vector<uint64_t> &tileOffsets,
+                          vector<uint64_t> &tileSizes) {
+    uint64_t numtiles = layout.numRowTiles() * layout.numColTiles();
+    tileOffsets.assign(numtiles, 0);
+    tileSizes.assign(numtiles, 0);
+
+    uint64_t pos = tilesStart(layout);
+    while (pos + sizeof(SkimTileHeader) <= size) {
+        SkimTileHeader tile;
+        memcpy(&tile, data + pos, sizeof(tile));
+        uint64_t start = pos + sizeof(tile);
+        if (tile.rowTile >= layout.numRowTiles() ||
+            tile.colTile >= layout.numColTiles() ||
+            tile.size > size - start ||
+            checksum(data + start, tile.size) != tile.checksum) {
+            break;
+        }
+        uint64_t t = tile.rowTile * layout.numColTiles() + tile.colTile;
+        tileOffsets[t] = start;
+        tileSizes[t] = tile.size;
+        pos = start + tile.size;
+    }
+    return pos;
+}
+
+
+// read the header, origins and destinations of a skim, returning false if
+// data isn't one
+static bool readHeader(const char *data, uint64_t size, SkimLayout &layout,
+                       vector<long> &sources, vector<long> &targets) {
+    SkimHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SKIM_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SKIM_VERSION ||
+        header.tileRows == 0 || header.tileCols == 0) {
+        return false;
+    }
+    layout.numrows = header.numrows;
+    layout.numcols = header.numcols;
+    layout.tileRows = header.tileRows;
+    layout.tileCols = header.tileCols;
+    layout.fingerprint = header.fingerprint;
+    if (size < tilesStart(layout)) return false;
+
+    const int64_t *ids =
+        reinterpret_cast<const int64_t *>(data + sizeof(header));
+    sources.assign(ids, ids + layout.numrows);
+    targets.assign(ids + layout.numrows,
+                   ids + layout.numrows + layout.numcols);
+    return true;
+}
+
+
+SkimWriter::SkimWriter(const std::string &filename, const SkimLayout &layout,
+                       const vector<long> &sources,
+                       const vector<long> &targets)
+    : layout(layout), filename(filename) {
+    doneTiles.assign(layout.numRowTiles() * layout.numColTiles(), false);
+
+    // look for the tiles of an earlier run of the same skim
+    uint64_t resumeAt = 0;
+    std::ifstream exists(filename.c_str(), std::ios::binary);
+    if (exists) {
+        exists.close();
+        MappedFile old(filename);
+        SkimLayout oldLayout;
+        vector<long> oldSources, oldTargets;
+        if (readHeader(old.data(), old.size(), oldLayout, oldSources,
+                       oldTargets) &&
+            oldLayout.numrows == layout.numrows &&
+            oldLayout.numcols == layout.numcols &&
+            oldLayout.tileRows == layout.tileRows &&
+            oldLayout.tileCols == layout.tileCols &&
+            oldLayout.fingerprint == layout.fingerprint &&
+            oldSources == sources && oldTargets == targets) {
+            vector<uint64_t> offsets, sizes;
+            resumeAt = scanTiles(old.data(), old.size(), layout, offsets,
+                                 sizes);
+            for (uint64_t t = 0 ; t < offsets.size() ; t++) {
+                doneTiles[t] = offsets[t] != 0;
+            }
+        }
+    }
+
+    if (resumeAt > 0) {
+        // anything after the last whole tile is written over
+        out.open(filename.c_str(),
+                 std::ios::binary | std::ios::in | std::ios::out);
+        out.seekp(resumeAt);
+    } else {
+        out.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        SkimHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, SKIM_MAGIC, sizeof(header.magic));
+        header.version = SKIM_VERSION;
+        header.tileRows = layout.tileRows;
+        header.tileCols = layout.tileCols;
+        header.numrows = layout.numrows;
+        header.numcols = layout.numcols;
+        header.fingerprint = layout.fingerprint;
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        vector<int64_t> ids(sources.begin(), sources.end());
+        ids.insert(ids.end(), targets.begin(), targets.end());
+        out.write(reinterpret_cast<const char *>(ids.data()),
+                  ids.size() * sizeof(int64_t));
+        out.flush();
+    }
+    if (!out) {
+        throw std::runtime_error("Unable to open " + filename +
+                                 " for writing");
+    }
+}
+
+
+void SkimWriter::write(uint64_t rowTile, uint64_t colTile,
+                       const vector<char> &encoded) {
+    SkimTileHeader tile = {static_cast<uint32_t>(rowTile),
+                           static_cast<uint32_t>(colTile),
+                           encoded.size(),
+                           checksum(encoded.data(), encoded.size())};
+    out.write(reinterpret_cast<const char *>(&tile), sizeof(tile));
+    out.write(encoded.data(), encoded.size());
+    out.flush();
+    if (!out) {
+        throw std::runtime_error("error writing " + filename);
+    }
+    doneTiles[rowTile * layout.numColTiles() + colTile] = true;
+}
+
+
+void SkimWriter::encode(const uint32_t *cells, uint64_t size,
+                        vector<char> &encoded) {
+    encoded.clear();
+    int64_t prev = 0;
+    for (uint64_t i = 0 ; i < size ; i++) {
+        int64_t delta = static_cast<int64_t>(cells[i]) - prev;
+        prev = cells[i];
+        uint64_t zigzag = (static_cast<uint64_t>(delta) << 1) ^
+            static_cast<uint64_t>(delta >> 63);
+        while (zigzag >= 0x80) {
+            encoded.push_back(static_cast<char>(zigzag | 0x80));
+            zigzag >>= 7;
+        }
+        encoded.push_back(static_cast<char>(zigzag));
+    }
+}
+
+
+SkimReader::SkimReader(const std::string &filename)
+    : filename(filename), file(new MappedFile(filename)) {
+    if (!readHeader(file->data(), file->size(), layout, sources, targets)) {
+        throw std::runtime_error(filename + " is not a skim file");
+    }
+    scanTiles(file->data(), file->size(), layout, tileOffsets, tileSizes);
+}
+
+
+void SkimReader::readRows(uint64_t first, uint64_t count,
+                          float *matrix) const {
+    if (first + count > layout.numrows) {
+        throw std::runtime_error("rows out of range of " + filename);
+    }
+    if (count == 0) return;
+
+    uint64_t lastTile = (first + count - 1) / layout.tileRows;
+    for (uint64_t rt = first / layout.tileRows ; rt <= lastTile ; rt++) {
+        uint64_t tileFirst = rt * layout.tileRows;
+        uint64_t rows = std::min<uint64_t>(layout.tileRows,
+                                           layout.numrows - tileFirst);
+        for (uint64_t ct = 0 ; ct < layout.numColTiles() ; ct++) {
+            uint64_t t = rt * layout.numColTiles() + ct;
+            if (tileOffsets[t] == 0) {
+                throw std::runtime_error(filename + " is incomplete");
+            }
+            uint64_t colFirst = ct * layout.tileCols;
+            uint64_t cols = std::min<uint64_t>(layout.tileCols,
+                                               layout.numcols - colFirst);
+
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(
+                file->data() + tileOffsets[t]);
+            const unsigned char *end = p + tileSizes[t];
+            int64_t prev = 0;
+            for (uint64_t r = 0 ; r < rows ; r++) {
+                for (uint64_t c = 0 ; c < cols ; c++) {
+                    uint64_t zigzag = 0;
+                    for (int shift = 0 ; ; shift += 7) {
+                        if (p == end) {
+                            throw std::runtime_error(filename +
+                                                     " is corrupt");
+                        }
+                        zigzag |= static_cast<uint64_t>(*p & 0x7f) << shift;
+                        if (!(*p++ & 0x80)) break;
+                    }
+                    prev += static_cast<int64_t>(zigzag >> 1) ^
+                        -static_cast<int64_t>(zigzag & 1);
+                    uint64_t row = tileFirst + r;
+                    if (row >= first && row < first + count) {
+                        matrix[(row - first) * layout.numcols +
+                               colFirst + c] =
+                            static_cast<uint32_t>(prev) / DISTANCEMULTFACT;
+                    }
+                }
+            }
+        }
+    }
+}
+}  // namespace accessibility
+}  // namespace MTC
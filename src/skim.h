@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "shared.h"
+#include "mappedfile.h"
+
+namespace MTC {
+namespace accessibility {
+
+using std::vector;
+
+// the shape of a skim - a matrix of the distances from numrows origins to
+// numcols destinations, cut into tiles of tileRows by tileCols cells (the
+// last tiles of a row or column being smaller), which are stored and
+// compressed one at a time.  fingerprint identifies the graph it was
+// computed on
+struct SkimLayout {
+    uint64_t numrows;
+    uint64_t numcols;
+    uint32_t tileRows;
+    uint32_t tileCols;
+    uint64_t fingerprint;
+
+    uint64_t numRowTiles() const { return (numrows + tileRows - 1) / tileRows; }
+    uint64_t numColTiles() const { return (numcols + tileCols - 1) / tileCols; }
+};
+
+// a skim file is the header, the origins and destinations, and then the
+// tiles in the order they were finished - each is a small record with its
+// position, size and checksum followed by the encoded cells.  the cells
+// of a tile are the distances in the units of the contraction hierarchy,
+// row by row, each stored as the zigzag varint of its difference from the
+// cell before it, which is lossless and small because nearby cells of a
+// skim differ little
+class SkimWriter {
+ public:
+    // start writing a skim to filename - if the file already holds part of
+    // a skim with the same layout, origins and destinations the tiles in
+    // it are kept, so an interrupted run can pick up where it stopped, and
+    // otherwise the file is started afresh.  throws std::runtime_error if
+    // the file can't be written
+    SkimWriter(const std::string &filename, const SkimLayout &layout,
+               const vector<long> &sources, const vector<long> &targets);
+
+    // whether the tile is already in the file
+    bool done(uint64_t rowTile, uint64_t colTile) const {
+        return doneTiles[rowTile * layout.numColTiles() + colTile];
+    }
+
+    // append a tile encoded with encode and flush it to disk
+    void write(uint64_t rowTile, uint64_t colTile, const vector<char> &encoded);
+
+    static void encode(const uint32_t *cells, uint64_t size,
+                       vector<char> &encoded);
+
+    SkimLayout layout;
+
+ private:
+    std::string filename;
+    std::ofstream out;
+    vector<bool> doneTiles;
+};
+
+// random access to the rows of a skim file, which is memory mapped
+class SkimReader {
+ public:
+    // throws std::runtime_error if the file isn't a skim
+    explicit SkimReader(const std::string &filename);
+
+    // rows first to first+count-1 of the skim, in the same units as the
+    // other distances - throws std::runtime_error if some of their tiles
+    // haven't been written
+    void readRows(uint64_t first, uint64_t count, float *matrix) const;
+
+    SkimLayout layout;
+    vector<long> sources;
+    vector<long> targets;
+
+ private:
+    std::string filename;
+    std::shared_ptr<MappedFile> file;
+    // where the cells of each tile start in the file, 0 if they're missing
+    vector<uint64_t> tileOffsets;
+    vector<uint64_t> tileSizes;
+};
+}  // namespace accessibility
+}  // namespace MTC
@@ -4,6 +4,7 @@ import pandas as pd
 import numpy as np
 import pytest
 import os
+import threading
 from numpy.testing import assert_almost_equal
 from pandana.cyaccess import cyaccess
 
@@ -62,6 +63,27 @@ def test_agg_analysis(net, nodes_and_edges):
     assert np.alltrue(np.isnan(ret))
 
 
+def test_many_agg_analysis(net, nodes_and_edges):
+    nodes = nodes_and_edges[0]
+    NUM_NODES = 30
+    np.random.seed(0)
+    random_node_ids = np.random.choice(np.arange(len(nodes)), NUM_NODES)
+    random_vals = np.random.random(NUM_NODES) * 100
+    net.initialize_access_var(b'test', random_node_ids, random_vals)
+
+    specs = [(b'test', b'sum', b'flat'), (b'test', b'mean', b'linear'),
+             (b'test', b'median', b'flat'), (b'test', b'this is', b'bogus')]
+    ret = net.get_many_aggregate_accessibility_variables(
+        10, [s[0] for s in specs], [s[1] for s in specs], [s[2] for s in specs])
+    assert ret.shape == (len(specs), len(nodes))
+
+    # each row matches the single aggregation, invalid ones are missing
+    for i, spec in enumerate(specs[:-1]):
+        single = net.get_all_aggregate_accessibility_variables(10, *spec)
+        assert_almost_equal(ret[i], single)
+    assert np.isnan(ret[-1]).all()
+
+
 def test_poi_analysis(net, nodes_and_edges):
     nodes = nodes_and_edges[0]
     NUM_NODES = 30
@@ -86,6 +108,96 @@ def test_poi_analysis(net, nodes_and_edges):
     assert s[5] == 41
 
 
+def test_construct_from_arrays(net, nodes_and_edges):
+    nodes, edges, edge_weights = nodes_and_edges
+    node_ids = nodes.index.values.astype('int_')
+
+    # contiguous arrays are read in place and strided ones copied first,
+    # which gives the same network
+    edge_array = np.ascontiguousarray(edges.values.astype('int_'))
+    weights = np.ascontiguousarray(edge_weights.values.T)
+    strided = np.asfortranarray(edge_array)
+    assert not strided.flags.c_contiguous
+    for e in edge_array, strided:
+        other = cyaccess(node_ids, nodes.values, e, weights, True)
+        assert other.shortest_path_distance(996, 71) == \
+            net.shortest_path_distance(996, 71)
+
+    with pytest.raises(ValueError):
+        cyaccess(node_ids, nodes.values, edge_array, weights[:, :-1], True)
+    edge_array[0, 1] = len(nodes)
+    with pytest.raises(RuntimeError):
+        cyaccess(node_ids, nodes.values, edge_array, weights, True)
+
+
+def test_csr_results(net, nodes_and_edges):
+    nodes = nodes_and_edges[0]
+    srcs = np.array([996, 5, 71])
+    dsts = np.array([71, 996, 5])
+
+    # the arrays wrap the results of the extension rather than copies
+    offsets, path_nodes = net.shortest_paths(srcs, dsts)
+    assert not offsets.flags.owndata and not path_nodes.flags.owndata
+    assert len(offsets) == len(srcs) + 1
+    for i in range(len(srcs)):
+        assert list(path_nodes[offsets[i]:offsets[i + 1]]) == \
+            list(net.shortest_path(srcs[i], dsts[i]))
+
+    ext_ids = nodes.index.values.astype('int_')
+    offsets, in_range, dists = net.nodes_in_range(
+        list(ext_ids[srcs]), 5, 0, ext_ids)
+    assert len(offsets) == len(srcs) + 1
+    assert offsets[-1] == len(in_range) == len(dists)
+    assert dists.dtype == np.float32
+    position = pd.Series(np.arange(len(ext_ids)), index=ext_ids)
+    for i, src in enumerate(srcs):
+        for j in range(offsets[i], min(offsets[i + 1], offsets[i] + 5)):
+            assert_almost_equal(
+                dists[j], net.shortest_path_distance(src, position[in_range[j]]),
+                decimal=3)
+
+
+def test_concurrent_queries(net, nodes_and_edges):
+    nodes = nodes_and_edges[0]
+    np.random.seed(1)
+    node_ids = np.random.choice(np.arange(len(nodes)), 30)
+    net.initialize_access_var(b'threads', node_ids, np.random.random(30))
+    net.initialize_category(10, 3, b'threads', node_ids)
+    srcs = np.arange(0, len(nodes), 7)
+    dsts = srcs[::-1].copy()
+
+    def query():
+        return (net.get_all_aggregate_accessibility_variables(
+                    10, b'threads', b'sum', b'flat'),
+                net.find_all_nearest_pois(10, 3, b'threads')[0],
+                net.shortest_path_distances(srcs, dsts))
+    expected = query()
+
+    # the queries of every thread run at once, each on its own scratch
+    # space, while another thread keeps changing the network
+    results = {}
+
+    def run(i):
+        results[i] = [query() for _ in range(3)]
+
+    def change():
+        for _ in range(3):
+            net.initialize_access_var(b'other', node_ids, np.ones(30))
+
+    threads = [threading.Thread(target=run, args=(i,)) for i in range(4)]
+    threads.append(threading.Thread(target=change))
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    assert len(results) == 4
+    for runs in results.values():
+        for result in runs:
+            for got, want in zip(result, expected):
+                assert_almost_equal(got, want)
+
+
 def test_shortest_path(net):
     route = pd.Series(net.shortest_path(996, 71))
     # interestingly this route has two shortest poths both of length 24
@@ -46,6 +46,25 @@ def second_sample_osm(request):
     return net
 
 
+# the nodes and edges of the sample, for tests that build their own network
+@pytest.fixture(scope="module")
+def osm_nodes_edges():
+    store = pd.HDFStore(os.path.join(os.path.dirname(__file__), "osm_sample.h5"), "r")
+    nodes, edges = store.nodes, store.edges
+    store.close()
+
+    return nodes, edges
+
+
+# a oneway network of the sample, for tests that only query it
+@pytest.fixture(scope="module")
+def oneway_osm(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+    return pdna.Network(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], twoway=False
+    )
+
+
 def random_node_ids(net, ssize):
     return pd.Series(np.random.choice(net.node_ids, ssize))
 
@@ -129,6 +148,416 @@ def test_agg_variables_accuracy(sample_osm):
     assert_allclose(s.mean(), r.std(), atol=1e-2)
 
 
+def test_aggregate_many(sample_osm):
+    net = sample_osm
+
+    ssize = 50
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize), name="foo")
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize), name="bar")
+
+    aggregations = [
+        ("foo", "sum", "linear"),
+        ("foo", "AVE", "flat"),
+        ("bar", "count", "flat"),
+        ("bar", "75pct", "exp"),
+    ]
+    df = net.aggregate_many(500, aggregations)
+    assert len(df) == len(net.node_ids)
+
+    for name, type, decay in aggregations:
+        s = net.aggregate(500, type=type, decay=decay, name=name)
+        assert_allclose(df[(name, type, decay)], s)
+
+
+def test_agg_multiple_distances(sample_osm):
+    net = sample_osm
+
+    ssize = 50
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize))
+
+    distances = [5, 20, 10]
+    for type in ["sum", "count", "median"]:
+        for decay in ["linear", "exp", "flat"]:
+            df = net.aggregate(distances, type=type, decay=decay)
+            assert list(df.columns) == distances
+            for distance in distances:
+                s = net.aggregate(distance, type=type, decay=decay)
+                assert_allclose(df[distance], s)
+
+
+def test_agg_node_subset(sample_osm):
+    net = sample_osm
+
+    ssize = 50
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize))
+
+    node_ids = random_node_ids(net, 20).values
+    for type in ["sum", "median", "count"]:
+        s = net.aggregate(500, type=type, node_ids=node_ids)
+        assert list(s.index) == list(node_ids)
+        assert_allclose(s, net.aggregate(500, type=type).loc[node_ids])
+
+    # several distances share one search per node here too
+    df = net.aggregate([500, 100], type="sum", node_ids=node_ids)
+    assert list(df.index) == list(node_ids)
+    assert_allclose(df, net.aggregate([500, 100], type="sum").loc[node_ids])
+
+
+def test_agg_quantile_sketch(sample_osm):
+    net = sample_osm
+
+    ssize = 500
+    node_ids = random_node_ids(net, ssize)
+    data = random_data(ssize)
+    bins = 100
+    half_bin = (data.max() - data.min()) / bins / 2
+
+    net.set(node_ids, variable=data)
+    net.set(node_ids, variable=data, name="sketched", quantile_bins=bins)
+    for type in ["25pct", "median", "75pct"]:
+        exact = net.aggregate(500, type=type)
+        approx = net.aggregate(500, type=type, name="sketched")
+        assert ((exact == -1) == (approx == -1)).all()
+        assert (exact - approx).abs().max() <= half_bin * 1.0001
+
+
+def test_agg_sparse_variable(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+
+    # a variable on few nodes is pushed from those nodes unless the range
+    # queries were precomputed, and both have to agree
+    net = pdna.Network(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], twoway=False
+    )
+    ssize = 20
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize))
+
+    types = ["sum", "mean", "min", "max", "std", "count"]
+    pushed = {
+        (type, decay): net.aggregate(500, type=type, decay=decay)
+        for type in types
+        for decay in ["linear", "exp", "flat"]
+    }
+    net.precompute(500)
+    for (type, decay), s in pushed.items():
+        assert_allclose(s, net.aggregate(500, type=type, decay=decay), atol=1e-5)
+
+
+def test_phast_engine(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+
+    net = pdna.Network(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], twoway=False
+    )
+    ssize = 200
+    net.set(random_node_ids(net, ssize), variable=random_data(ssize))
+
+    for type in ["sum", "median", "count"]:
+        assert_allclose(
+            net.aggregate(500, type=type, engine="phast"),
+            net.aggregate(500, type=type),
+        )
+
+    snaps = random_node_ids(net, 10)
+    dijkstra = net.nodes_in_range(snaps, 300)
+    phast = net.nodes_in_range(snaps, 300, engine="phast")
+    key = ["source", "destination"]
+    assert_allclose(
+        dijkstra.sort_values(key).weight.values, phast.sort_values(key).weight.values
+    )
+
+    net.precompute(500, engine="phast")
+    assert_allclose(
+        net.aggregate(500, type="sum"), net.aggregate(500, type="sum", engine="phast")
+    )
+
+
+def test_cch(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+
+    # some of the edges have no length, which both hierarchies take as the
+    # smallest length they can hold
+    edges = edges.copy()
+    edges.loc[edges.sample(100, random_state=0).index, "weight"] = 0
+    edges["time"] = edges.weight * np.random.uniform(0.5, 2, len(edges))
+    args = nodes.x, nodes.y, edges["from"], edges.to, edges[["weight", "time"]]
+    ch = pdna.Network(*args, twoway=False)
+    cch = pdna.Network(*args, twoway=False, hierarchy="cch")
+
+    orig = random_node_ids(ch, 200).values
+    dest = random_node_ids(ch, 200).values
+    ssize = 50
+    node_ids = random_node_ids(ch, ssize)
+    data = random_data(ssize)
+    x, y = random_x_y(ch, 100)
+    for net in ch, cch:
+        net.set(node_ids, variable=data)
+        net.set_pois("restaurants", 2000, 10, x, y)
+
+    for imp in ["weight", "time"]:
+        assert_allclose(
+            cch.shortest_path_lengths(orig, dest, imp_name=imp),
+            ch.shortest_path_lengths(orig, dest, imp_name=imp),
+        )
+        assert_allclose(
+            cch.aggregate(500, type="sum", imp_name=imp, engine="phast"),
+            ch.aggregate(500, type="sum", imp_name=imp),
+        )
+        assert_allclose(
+            cch.nearest_pois(2000, "restaurants", num_pois=5, imp_name=imp),
+            ch.nearest_pois(2000, "restaurants", num_pois=5, imp_name=imp),
+        )
+
+    # the routes are shortest paths too, though ties may be broken differently
+    steps = edges.set_index(["from", "to"]).weight
+    for path, length in zip(
+        cch.shortest_paths(orig[:20], dest[:20], imp_name="weight"),
+        cch.shortest_path_lengths(orig[:20], dest[:20], imp_name="weight"),
+    ):
+        if len(path) == 0:
+            continue
+        total = sum(steps.loc[[(a, b)]].min() for a, b in zip(path[:-1], path[1:]))
+        assert total == pytest.approx(length, abs=0.1)
+
+    with pytest.raises(RuntimeError):
+        pdna.Network(*args, hierarchy="nope")
+
+
+def test_memory_usage(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+
+    edges = edges.copy()
+    edges["time"] = edges.weight * np.random.uniform(0.5, 2, len(edges))
+    net = pdna.Network(nodes.x, nodes.y, edges["from"], edges.to,
+                       edges[["weight", "time"]], twoway=False)
+
+    # the impedances share the edges and only keep their own weights
+    usage = net.memory_usage()
+    assert list(usage.columns) == ["shared", "weight", "time"]
+    assert usage.loc["edge topology", "shared"] > 0
+    assert usage.loc["edge topology", ["weight", "time"]].sum() == 0
+    for imp in ["weight", "time"]:
+        assert usage.loc["edge weights", imp] == 4 * len(edges)
+        assert usage.loc["contracted graph", imp] > 0
+        assert usage.loc["edge weights", imp] < usage.loc["edge topology", "shared"]
+
+    # each impedance still routes on its own weights
+    single = pdna.Network(nodes.x, nodes.y, edges["from"], edges.to,
+                          edges[["time"]], twoway=False)
+    orig = random_node_ids(net, 100).values
+    dest = random_node_ids(net, 100).values
+    assert_allclose(
+        net.shortest_path_lengths(orig, dest, imp_name="time"),
+        single.shortest_path_lengths(orig, dest),
+    )
+
+
+def test_update_weights(osm_nodes_edges, tmpdir):
+    nodes, edges = osm_nodes_edges
+
+    args = nodes.x, nodes.y, edges["from"], edges.to
+    changed = edges.weight.sample(300, random_state=0)
+    weights = edges[["weight"]].copy()
+    weights.loc[changed.index, "weight"] = changed * np.random.uniform(0.2, 5, len(changed))
+
+    expected = pdna.Network(*args, weights, twoway=False)
+    orig = random_node_ids(expected, 200).values
+    dest = random_node_ids(expected, 200).values
+    targets = random_node_ids(expected, 7)
+    ssize = 50
+    node_ids = random_node_ids(expected, ssize)
+    data = random_data(ssize)
+    x, y = random_x_y(expected, 100)
+
+    for hierarchy in "ch", "cch":
+        net = pdna.Network(*args, edges[["weight"]], twoway=False, hierarchy=hierarchy)
+        for n in net, expected:
+            n.set(node_ids, variable=data)
+            n.set_pois("restaurants", 2000, 10, x, y)
+            n.set_targets(targets, name="dests")
+        net.precompute(500)
+
+        # twice, as the first update of a network customizes it from scratch
+        half = len(changed) // 2
+        net.update_weights(weights.weight.loc[changed.index[:half]])
+        net.update_weights(weights.weight.loc[changed.index[half:]])
+
+        assert_allclose(
+            net.shortest_path_lengths(orig, dest),
+            expected.shortest_path_lengths(orig, dest),
+        )
+        assert_allclose(net.aggregate(500, type="sum"), expected.aggregate(500, type="sum"))
+        assert_allclose(
+            net.nearest_pois(2000, "restaurants", num_pois=5),
+            expected.nearest_pois(2000, "restaurants", num_pois=5),
+        )
+        assert_allclose(
+            net.shortest_path_lengths_to_targets(orig[:10], name="dests"),
+            expected.shortest_path_lengths_to_targets(orig[:10], name="dests"),
+        )
+        assert_allclose(net.edges_df.weight, weights.weight)
+
+    # what's saved after the updates belongs to a network built with the
+    # new weights
+    filename = str(tmpdir.join("ch.bin"))
+    net.save_ch(filename)
+    loaded = pdna.Network.load_ch(*args, weights, filename, twoway=False)
+    assert_allclose(
+        loaded.shortest_path_lengths(orig, dest),
+        expected.shortest_path_lengths(orig, dest),
+    )
+    filename = str(tmpdir.join("range.bin"))
+    net.precompute(500)
+    net.save_precomputed(filename)
+    expected.load_precomputed(filename)
+    assert_allclose(expected.aggregate(500, type="sum"), net.aggregate(500, type="sum"))
+
+    with pytest.raises(ValueError):
+        net.update_weights(pd.Series([1.0], index=[-1]))
+
+
+def test_shortest_path_length_matrix(oneway_osm):
+    net = oneway_osm
+    sources = random_node_ids(net, 20).values
+    targets = random_node_ids(net, 30).values
+    lens = net.shortest_path_length_matrix(sources, targets)
+    assert lens.shape == (20, 30)
+    assert lens.dtype == np.float32
+
+    pairs = np.array([(s, t) for s in sources for t in targets])
+    expected = net.shortest_path_lengths(pairs[:, 0], pairs[:, 1])
+    assert_allclose(lens.ravel(), np.array(expected, dtype=np.float32))
+
+
+def test_write_skim(oneway_osm, tmpdir):
+    net = oneway_osm
+    sources = random_node_ids(net, 25).values
+    targets = random_node_ids(net, 18).values
+    expected = net.shortest_path_length_matrix(sources, targets)
+
+    filename = str(tmpdir.join("skim.bin"))
+    net.write_skim(filename, sources, targets, tile_size=7)
+    skim = net.read_skim(filename)
+    assert_allclose(skim.values, expected)
+    assert list(skim.index) == list(sources)
+    assert list(skim.columns) == list(targets)
+    assert_allclose(net.read_skim(filename, 9, 10).values, expected[9:19])
+
+    # cut the file short as if the run had been interrupted, and resume
+    with open(filename, "rb") as f:
+        data = f.read()
+    with open(filename, "wb") as f:
+        f.write(data[: len(data) * 2 // 3])
+    with pytest.raises(RuntimeError):
+        net.read_skim(filename)
+    net.write_skim(filename, sources, targets, tile_size=7)
+    assert_allclose(net.read_skim(filename).values, expected)
+
+
+def test_symmetric_distance_matrix(sample_osm, tmpdir):
+    zones = random_node_ids(sample_osm, 23).values
+    expected = sample_osm.shortest_path_length_matrix(zones, zones)
+    pairs = np.array([(s, t) for s in zones for t in zones])
+    assert_allclose(
+        expected.ravel(),
+        np.array(sample_osm.shortest_path_lengths(pairs[:, 0], pairs[:, 1]),
+                 dtype=np.float32),
+    )
+    assert_allclose(expected, expected.T)
+
+    filename = str(tmpdir.join("skim.bin"))
+    sample_osm.write_skim(filename, zones, zones, tile_size=5)
+    assert_allclose(sample_osm.read_skim(filename).values, expected)
+
+
+def test_shortest_path_lengths_to_targets(osm_nodes_edges):
+    nodes, edges = osm_nodes_edges
+
+    net = pdna.Network(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], twoway=False
+    )
+    targets = random_node_ids(net, 7)
+    net.set_targets(targets, name="dests")
+
+    sources = random_node_ids(net, 10).values
+    lens = net.shortest_path_lengths_to_targets(sources, name="dests")
+    assert lens.shape == (10, 7)
+
+    for i, src in enumerate(sources):
+        expected = net.shortest_path_lengths([src] * 7, targets.values)
+        assert_allclose(lens.values[i], expected)
+
+    assert net.shortest_path_lengths_to_targets([], name="dests").shape == (0, 7)
+
+
+def test_save_load_precomputed(osm_nodes_edges, tmpdir):
+    nodes, edges = osm_nodes_edges
+
+    net = pdna.Network(nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]])
+    net.precompute(500)
+    filename = str(tmpdir.join("range.bin"))
+    net.save_precomputed(filename)
+
+    ssize = 50
+    node_ids = random_node_ids(net, ssize)
+    data = random_data(ssize)
+    net.set(node_ids, variable=data)
+    expected = net.aggregate(500, type="sum", decay="linear")
+
+    net2 = pdna.Network(nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]])
+    net2.load_precomputed(filename)
+    net2.set(node_ids, variable=data)
+    assert_allclose(net2.aggregate(500, type="sum", decay="linear"), expected)
+
+    # the saved queries only belong to a network with the same edges
+    net3 = pdna.Network(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]] * 2
+    )
+    with pytest.raises(RuntimeError):
+        net3.load_precomputed(filename)
+
+
+def test_save_load_ch(osm_nodes_edges, tmpdir):
+    nodes, edges = osm_nodes_edges
+
+    net = pdna.Network(nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]])
+    filename = str(tmpdir.join("ch.bin"))
+    net.save_ch(filename)
+
+    net2 = pdna.Network.load_ch(
+        nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], filename
+    )
+    orig = random_node_ids(net, 50).values
+    dest = random_node_ids(net, 50).values
+    assert_allclose(
+        net2.shortest_path_lengths(orig, dest), net.shortest_path_lengths(orig, dest)
+    )
+
+    node_ids = random_node_ids(net, 50)
+    data = random_data(50)
+    net.set(node_ids, variable=data)
+    net2.set(node_ids, variable=data)
+    assert_allclose(
+        net2.aggregate(500, type="sum", decay="linear"),
+        net.aggregate(500, type="sum", decay="linear"),
+    )
+
+    # the saved hierarchies only belong to a network with the same edges
+    with pytest.raises(RuntimeError):
+        pdna.Network.load_ch(
+            nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]] * 2, filename
+        )
+
+    # nor to a build whose edge records differ from those of the one saving it
+    with open(filename, "r+b") as f:
+        f.seek(28)
+        f.write(np.uint32(1).tobytes())
+    with pytest.raises(RuntimeError):
+        pdna.Network.load_ch(
+            nodes.x, nodes.y, edges["from"], edges.to, edges[["weight"]], filename
+        )
+
+
 def test_non_integer_nodeids(request):
 
     store = pd.HDFStore(os.path.join(os.path.dirname(__file__), "osm_sample.h5"), "r")
@@ -276,6 +705,8 @@ def test_shortest_paths(sample_osm):
         path = sample_osm.shortest_path(nodes[i], nodes[i + 50])
         assert np.array_equal(vec_paths[i], path)
 
+    assert sample_osm.shortest_paths([], []) == []
+
     # check mismatched OD lists
     try:
         vec_paths = sample_osm.shortest_paths(nodes[0:51], nodes[50:100])
@@ -284,6 +715,30 @@ def test_shortest_paths(sample_osm):
         pass
 
 
+def test_shortest_paths_grouped_by_source(sample_osm):
+    # several pairs share each origin, in no particular order
+    np.random.seed(0)
+    origins = random_connected_nodes(sample_osm, 5)
+    sources = np.random.choice(origins, 60)
+    targets = random_connected_nodes(sample_osm, 60)
+
+    lens = sample_osm.shortest_path_lengths(sources, targets)
+    expected = [sample_osm.shortest_path_length(s, t) for s, t in zip(sources, targets)]
+    assert_allclose(lens, expected)
+
+    edges = sample_osm.edges_df
+    weights = {}
+    for a, b, w in zip(edges["from"], edges["to"], edges["weight"]):
+        weights[(a, b)] = weights[(b, a)] = min(w, weights.get((a, b), np.inf))
+
+    paths = sample_osm.shortest_paths(sources, targets)
+    for i, path in enumerate(paths):
+        assert path[0] == sources[i]
+        assert path[-1] == targets[i]
+        length = sum(weights[(a, b)] for a, b in zip(path[:-1], path[1:]))
+        assert_allclose(length, expected[i], atol=1e-3)
+
+
 def test_shortest_path_length(sample_osm):
 
     for i in range(10):
@@ -307,6 +762,37 @@ def test_shortest_path_lengths(sample_osm):
         pass
 
 
+def test_queries_from_threads(sample_osm):
+    import threading
+
+    net = sample_osm
+    nodes = random_connected_nodes(net, 200)
+    expected = net.shortest_path_lengths(nodes[:100], nodes[100:])
+    paths = net.shortest_paths(nodes[:100], nodes[100:])
+
+    # the calls release the GIL, and queries on the same network run at once,
+    # each on its own scratch space
+    results, errors = [], []
+
+    def run():
+        try:
+            for _ in range(5):
+                assert net.shortest_path_lengths(nodes[:100], nodes[100:]) == expected
+                for a, b in zip(net.shortest_paths(nodes[:100], nodes[100:]), paths):
+                    assert np.array_equal(a, b)
+            results.append(True)
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=run) for _ in range(4)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert errors == []
+    assert len(results) == len(threads)
+
+
 def test_pois(sample_osm):
     net = sample_osm
 